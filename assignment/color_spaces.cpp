@@ -7,6 +7,8 @@ using namespace al;
 
 #include <fstream>
 #include <vector>
+
+#include "common/parallel.cpp"  // parallelFor, parallelReduce
 using namespace std;
 
 const char* vertexCode = R"(
@@ -76,61 +78,71 @@ struct AlloApp : App {
   vector<Vec3f> hsv;
 
   void calcCube() { //rgb cube
-    for (int i = 0; i < mesh.colors().size(); i++) { //loop through the colors
-      //get the pixel color value
-      Vec3f col(mesh.colors()[i].r, mesh.colors()[i].g, mesh.colors()[i].b);
-      //assign a position based on the color
-      cube.push_back(col);
-      //printf("%f", mesh.colors()[i].rgb());
-    }
+    cube.resize(mesh.colors().size());
+    parallelFor(mesh.colors().size(), 4096, [&](int begin, int end) {
+      for (int i = begin; i < end; i++) { //loop through the colors
+        //get the pixel color value
+        Vec3f col(mesh.colors()[i].r, mesh.colors()[i].g, mesh.colors()[i].b);
+        //assign a position based on the color
+        cube[i] = col;
+        //printf("%f", mesh.colors()[i].rgb());
+      }
+    });
   }
 
   void calcCylinder() { //hsv cylinder -> conversions taken from https://en.wikipedia.org/wiki/HSL_and_HSV 
-    for (int i = 0; i < mesh.colors().size(); i++) {
-      double h = 0.0;
-      double s = 0.0;
-      double v = 0.0;
-
-      double min = std::min( std::min(mesh.colors()[i].r, mesh.colors()[i].g), mesh.colors()[i].b );
-      double max = std::max( std::max(mesh.colors()[i].r, mesh.colors()[i].g), mesh.colors()[i].b );
-
-      double delta = max - min;
-
-      //hue
-      if( max == min) {
-          h = 0.0;
-      } else if (mesh.colors()[i].r == max ) {
-          h =  (mesh.colors()[i].g - mesh.colors()[i].b ) / delta;     // between yellow & magenta
-      } else if( mesh.colors()[i].g == max ) {
-          h = 2.0 + ( mesh.colors()[i].b - mesh.colors()[i].r ) / delta;   // between cyan & yellow
-      } else {
-          h = 4.0 + ( mesh.colors()[i].r - mesh.colors()[i].g ) / delta;   // between magenta & cyan
-      }
+    hsv.resize(mesh.colors().size());
+    cylinder.resize(mesh.colors().size());
+    parallelFor(mesh.colors().size(), 4096, [&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        double h = 0.0;
+        double s = 0.0;
+        double v = 0.0;
+
+        double min = std::min( std::min(mesh.colors()[i].r, mesh.colors()[i].g), mesh.colors()[i].b );
+        double max = std::max( std::max(mesh.colors()[i].r, mesh.colors()[i].g), mesh.colors()[i].b );
+
+        double delta = max - min;
+
+        //hue
+        if( max == min) {
+            h = 0.0;
+        } else if (mesh.colors()[i].r == max ) {
+            h =  (mesh.colors()[i].g - mesh.colors()[i].b ) / delta;     // between yellow & magenta
+        } else if( mesh.colors()[i].g == max ) {
+            h = 2.0 + ( mesh.colors()[i].b - mesh.colors()[i].r ) / delta;   // between cyan & yellow
+        } else {
+            h = 4.0 + ( mesh.colors()[i].r - mesh.colors()[i].g ) / delta;   // between magenta & cyan
+        }
 
-      h = h * 60.0;
+        h = h * 60.0;
 
-      if( h < 0.0 ) {h += 360.0;}
+        if( h < 0.0 ) {h += 360.0;}
 
-      // saturation
-      if( max != 0.0 ) {
-          s = delta / max;
-      } else {
-          s = 0.0;
-      }
-      
-      // value
-      v = max;
+        // saturation
+        if( max != 0.0 ) {
+            s = delta / max;
+        } else {
+            s = 0.0;
+        }
+        
+        // value
+        v = max;
 
-      hsv.push_back(Vec3f(h, s, v) / 5);
-      cylinder.push_back(  Vec3f(h, s, v) / 100  ); //divide to get the whole thing on screen (could also move nav???)
-    }
+        hsv[i] = Vec3f(h, s, v) / 5;
+        cylinder[i] = Vec3f(h, s, v) / 100; //divide to get the whole thing on screen (could also move nav???)
+      }
+    });
   }
 
   void calcWaves() {
-    for (int i = 0; i < mesh.vertices().size(); i++) {
-      Vec3f col(abs(mesh.colors()[i].r + hsv[i].x * 0.2), abs(mesh.colors()[i].g - hsv[i].y), abs(mesh.colors()[i].b - hsv[i].z * 0.6));
-      waves.push_back(col);
-    }
+    waves.resize(mesh.vertices().size());
+    parallelFor(mesh.vertices().size(), 4096, [&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        Vec3f col(abs(mesh.colors()[i].r + hsv[i].x * 0.2), abs(mesh.colors()[i].g - hsv[i].y), abs(mesh.colors()[i].b - hsv[i].z * 0.6));
+        waves[i] = col;
+      }
+    });
   }
 
   void onCreate() override {
@@ -190,17 +202,22 @@ struct AlloApp : App {
     // final - initial = vector of distance traveled
     // step through, adding to the previous position
 
-    Vec3f maxDist(0, 0, 0);
-    int index = 0;
-    for (int i = 0; i < mesh.vertices().size(); i++) {
-      Vec3f d( (vec[i].x - mesh.vertices()[i].x), (vec[i].y - mesh.vertices()[i].y), (vec[i].z - mesh.vertices()[i].z));
-      //std::cout << d << std::endl;
-      if (d > maxDist) {
-        maxDist = d;
-        index = i;
+    // every piece of the pixels finds its farthest one, then the pieces are compared in order (ties -> the first pixel, as before)
+    struct Farthest { Vec3f maxDist; int index; };
+    Farthest farthest = parallelReduce(mesh.vertices().size(), 16384, Farthest{Vec3f(0, 0, 0), 0}, [&](int begin, int end) {
+      Farthest f = {Vec3f(0, 0, 0), begin};
+      for (int i = begin; i < end; i++) {
+        Vec3f d( (vec[i].x - mesh.vertices()[i].x), (vec[i].y - mesh.vertices()[i].y), (vec[i].z - mesh.vertices()[i].z));
+        //std::cout << d << std::endl;
+        if (d > f.maxDist) {
+          f.maxDist = d;
+          f.index = i;
+        }
+        //distance.push_back(d);
       }
-      //distance.push_back(d);
-    }
+      return f;
+    }, [](Farthest a, Farthest b) { return b.maxDist > a.maxDist ? b : a; });
+    int index = farthest.index;
 
     // different methods of interpolation
     //both of these work for cube but not cylinder -> probably because cylinder isn't linear and cube is?
@@ -222,9 +239,11 @@ struct AlloApp : App {
     //while the one pixel who has to travel the max distance gets to it's final location
     while(  abs(mesh.vertices()[index].x) < abs(vec[index].x) - thresh*2  ) { 
       //std::cout << mesh.vertices()[index] << " " << vec[index] << std::endl;
-        for (int i = 0; i < mesh.vertices().size(); i++) {
-          mesh.vertices()[i].lerp(vec[i], thresh); //linear interpolation between positions
-        }
+        parallelFor(mesh.vertices().size(), 16384, [&](int begin, int end) {
+          for (int i = begin; i < end; i++) {
+            mesh.vertices()[i].lerp(vec[i], thresh); //linear interpolation between positions
+          }
+        });
         g.draw(mesh);
     }
   }
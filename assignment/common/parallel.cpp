@@ -0,0 +1,274 @@
+/* parallel.cpp
+ * ThreadPool -> one set of worker threads for the whole program, started the first time it is used and kept until exit
+ * It is work stealing: every thread that hands out jobs has its own queue, it takes its newest job back first (still in its cache)
+ * and a thread that runs out of work steals the oldest job of another queue (the biggest piece, since loops split in halves)
+ * parallelFor(n, grain, f) calls f(begin, end) over 0..n: the range is split in halves until the pieces are about grain items
+ * (or small enough for every thread to get a few), the calling thread runs pieces too
+ * parallelReduce(n, grain, identity, f, combine) -> combine(... combine(identity, f(0, grain)), f(grain, 2 * grain) ...)
+ * the pieces only depend on n and grain, and are combined in order -> the same result for any number of threads
+ * TaskGraph -> jobs with dependencies between them (the phases of a simulation step), a job starts on the pool as soon as
+ * everything it depends on is done, so independent jobs run at the same time
+ * A thread that waits (for a parallelFor, or a graph) runs jobs meanwhile -> jobs can call parallelFor without deadlocking
+ * setParallelThreads(n) / setParallelPinning(true) before the first use: n threads (the calling one included),
+ * each worker pinned to its own core (linux only, elsewhere the scheduler decides)
+ */
+
+#pragma once
+
+//c std library includes
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+struct ParallelSettings {
+  int threads = 0; // 0 -> one per hardware thread
+  bool pin = false;
+  bool fixed = false; // the thread count was read (the pool is about to start, or has) -> changing them does nothing anymore
+};
+
+inline ParallelSettings& parallelSettings() {
+  static ParallelSettings settings;
+  return settings;
+}
+
+inline int parallelThreads() {
+  static int threads = []() {
+    parallelSettings().fixed = true;
+    return parallelSettings().threads > 0 ? parallelSettings().threads : (int)max(1u, thread::hardware_concurrency());
+  }();
+  return threads;
+}
+
+// use this many threads (the calling thread included) -> only works before the first parallelFor, TaskGraph or parallelThreads()
+inline void setParallelThreads(int threads) {
+  if (parallelSettings().fixed) {
+    if (threads == parallelThreads()) { return; } // asked again for what it already has
+    cerr << "setParallelThreads(" << threads << ") ignored: the thread pool already has " << parallelThreads() << " threads" << endl;
+    return;
+  }
+  parallelSettings().threads = threads;
+}
+// pin every worker to a core of its own -> the same, only before the first use
+inline void setParallelPinning(bool pin) {
+  if (parallelSettings().fixed) {
+    if (pin == parallelSettings().pin) { return; }
+    cerr << "setParallelPinning(" << (pin ? "true" : "false") << ") ignored: the thread pool already started" << endl;
+    return;
+  }
+  parallelSettings().pin = pin;
+}
+
+struct ThreadPool {
+  static ThreadPool& instance() {
+    static ThreadPool pool(parallelThreads() - 1, parallelSettings().pin);
+    return pool;
+  }
+
+  struct JobQueue { // the owner pushes and pops at the back, thieves take from the front
+    mutex lock;
+    deque<function<void()>> jobs;
+  };
+  static const int MAX_QUEUES = 256; // workers, plus every other thread that ever handed out jobs (main, audio, loaders...)
+  unique_ptr<JobQueue> queues[MAX_QUEUES];
+  atomic<int> queueCount{0};
+  mutex registerLock;
+
+  vector<thread> workers;
+  atomic<int> queued{0}; // jobs waiting in all the queues
+  atomic<int> sleeping{0};
+  mutex sleepLock;
+  condition_variable wake;
+  atomic<bool> quit{false};
+
+  ThreadPool(int threads, bool pin) {
+    for (int t = 0; t < threads; t++) {
+      workers.emplace_back([this, t]() {
+        myQueue() = registerQueue(); // the workers come first
+        while (true) {
+          if (runOne()) { continue; }
+          //nothing to do -> spin a little (more work usually comes right away), then sleep until a job is queued
+          bool found = false;
+          for (int spin = 0; spin < 64 && !found; spin++) {
+            this_thread::yield();
+            found = queued.load(memory_order_acquire) > 0;
+          }
+          if (found) { continue; }
+          unique_lock<mutex> guard(sleepLock);
+          sleeping++; // seq_cst, like the load after it and the two in submit() -> either this thread sees the new job,
+                      // or submit() sees it sleeping and wakes it (acquire/release alone would let both miss)
+          wake.wait(guard, [&]() { return quit || queued.load(memory_order_seq_cst) > 0; });
+          sleeping--;
+          if (quit) { return; }
+        }
+      });
+#ifdef __linux__
+      if (pin) { // worker t on core t + 1, the core of the thread that started the pool is left alone
+        cpu_set_t cores;
+        CPU_ZERO(&cores);
+        CPU_SET((t + 1) % max(1u, thread::hardware_concurrency()), &cores);
+        pthread_setaffinity_np(workers.back().native_handle(), sizeof(cpu_set_t), &cores);
+      }
+#endif
+    }
+  }
+
+  ~ThreadPool() {
+    { lock_guard<mutex> guard(sleepLock); quit = true; }
+    wake.notify_all();
+    for (thread& t : workers) { t.join(); }
+  }
+
+  static int& myQueue() { // the calling thread's queue, -1 until it first hands out a job
+    static thread_local int queue = -1;
+    return queue;
+  }
+
+  int registerQueue() {
+    lock_guard<mutex> guard(registerLock);
+    int q = queueCount.load(memory_order_relaxed);
+    if (q == MAX_QUEUES) { return 0; } // too many threads -> share the first worker's queue, it has a lock anyway
+    queues[q].reset(new JobQueue);
+    queueCount.store(q + 1, memory_order_release);
+    return q;
+  }
+
+  void submit(function<void()> job) {
+    if (workers.empty()) { job(); return; } // one thread, nobody else would ever run it
+    if (myQueue() < 0) { myQueue() = registerQueue(); }
+    JobQueue& q = *queues[myQueue()];
+    { lock_guard<mutex> guard(q.lock); q.jobs.push_back(move(job)); }
+    queued.fetch_add(1, memory_order_seq_cst);
+    if (sleeping.load(memory_order_seq_cst) > 0) {
+      lock_guard<mutex> guard(sleepLock); // so the wake-up can't slip in between a worker's check and its wait
+      wake.notify_one();
+    }
+  }
+
+  bool runOne() { // run a job on the calling thread (its own newest, or another queue's oldest), false if there was none
+    if (queued.load(memory_order_acquire) == 0) { return false; }
+    function<void()> job;
+    int mine = myQueue();
+    if (mine >= 0) {
+      JobQueue& q = *queues[mine];
+      lock_guard<mutex> guard(q.lock);
+      if (!q.jobs.empty()) { job = move(q.jobs.back()); q.jobs.pop_back(); }
+    }
+    int count = queueCount.load(memory_order_acquire);
+    for (int k = 1; !job && k <= count; k++) { // steal, starting after our own queue so the thieves spread out
+      JobQueue& q = *queues[(max(mine, 0) + k) % count];
+      lock_guard<mutex> guard(q.lock);
+      if (!q.jobs.empty()) { job = move(q.jobs.front()); q.jobs.pop_front(); }
+    }
+    if (!job) { return false; }
+    queued.fetch_sub(1, memory_order_relaxed);
+    job();
+    return true;
+  }
+
+  void waitFor(const atomic<int>& pending) { // until pending is 0, running jobs meanwhile
+    while (pending.load(memory_order_acquire) > 0) {
+      if (!runOne()) { this_thread::yield(); }
+    }
+  }
+};
+
+// f(begin, end) on every piece of begin..end, pieces at least grain items: keep the first half, hand out the second
+template <class F>
+void parallelSplit(int begin, int end, int grain, F& f, atomic<int>& pending) {
+  ThreadPool& pool = ThreadPool::instance();
+  while (end - begin > grain) {
+    int middle = begin + (end - begin) / 2;
+    pending.fetch_add(1, memory_order_relaxed);
+    pool.submit([=, &f, &pending]() {
+      parallelSplit(middle, end, grain, f, pending);
+      pending.fetch_sub(1, memory_order_release);
+    });
+    end = middle;
+  }
+  f(begin, end);
+}
+
+template <class F>
+void parallelFor(int n, int grain, F f) {
+  if (n <= 0) { return; }
+  grain = max(grain, 1);
+  if (parallelThreads() == 1 || n <= grain) { f(0, n); return; }
+  grain = max(grain, n / (4 * parallelThreads())); // a few pieces per thread is enough to even out the load
+  atomic<int> pending(0);
+  parallelSplit(0, n, grain, f, pending);
+  ThreadPool::instance().waitFor(pending);
+}
+
+template <class T, class F, class Combine>
+T parallelReduce(int n, int grain, T identity, F f, Combine combine) {
+  grain = max(grain, 1);
+  int pieces = (n + grain - 1) / grain;
+  if (pieces <= 1) { return n > 0 ? combine(identity, f(0, n)) : identity; }
+  struct Partial { T value; }; // not a vector<T>: vector<bool> packs bits, the pieces would write the same bytes
+  vector<Partial> partial(pieces, Partial{identity});
+  parallelFor(pieces, 1, [&](int first, int last) {
+    for (int p = first; p < last; p++) { partial[p].value = f(p * grain, min(n, (p + 1) * grain)); }
+  });
+  T result = identity;
+  for (const Partial& p : partial) { result = combine(result, p.value); }
+  return result;
+}
+
+// add() the jobs once, with the jobs each one has to wait for, then run() the graph as often as needed
+struct TaskGraph {
+  struct Task {
+    string name;
+    function<void()> job;
+    vector<int> dependents; // the tasks waiting for this one
+    int dependencies = 0;
+    atomic<int> waitingOn{0}; // dependencies that haven't finished yet in this run
+  };
+  deque<Task> tasks; // a deque, so a Task (with its atomic) never moves
+  atomic<int> unfinished{0};
+
+  int add(const string& name, function<void()> job, const vector<int>& after = {}) { // returns the task's id
+    int id = (int)tasks.size();
+    tasks.emplace_back();
+    Task& t = tasks.back();
+    t.name = name;
+    t.job = move(job);
+    t.dependencies = (int)after.size();
+    for (int d : after) { tasks[d].dependents.push_back(id); }
+    return id;
+  }
+
+  void run() { // every task once, each after the ones it depends on, returns when all are done
+    if (tasks.empty()) { return; }
+    for (Task& t : tasks) { t.waitingOn.store(t.dependencies, memory_order_relaxed); }
+    unfinished.store((int)tasks.size(), memory_order_release);
+    for (int id = 0; id < (int)tasks.size(); id++) {
+      if (tasks[id].dependencies == 0) { start(id); }
+    }
+    ThreadPool::instance().waitFor(unfinished);
+  }
+
+  void start(int id) {
+    ThreadPool::instance().submit([this, id]() {
+      Task& t = tasks[id];
+      t.job();
+      for (int d : t.dependents) {
+        if (tasks[d].waitingOn.fetch_sub(1, memory_order_acq_rel) == 1) { start(d); }
+      }
+      unfinished.fetch_sub(1, memory_order_release);
+    });
+  }
+};
@@ -2,10 +2,15 @@
  * This file describes the properties and functionality of an "agent" -> this is for the simulation
  * This file also describes the properties of a "drawable agent" -> this is for the renderers ONLY
  * Agents have sound as well, described by Chirplet struct, which is generated using an impulse generator (struct)
+ * Everything random is drawn from the generator passed in by the simulation (a Philox stream of that agent, or an rnd::Random<>),
+ * so a seeded simulation is reproducible
+ * (the impulse generator runs on the audio thread, so it gets its own Philox stream, seeded by the agent)
+ * The simulation splits an agent into hot simulation state (AgentStore arrays) and a cold AgentVoice (sound and looks)
  */
 
 #pragma once
 #include "Gamma/Oscillator.h"
+#include "philox.cpp"
 using namespace al;
 // ************************************************************
 // Impulse Generator struct taken from Pedal, by Aaron Anderson
@@ -17,13 +22,14 @@ struct ImpulseGenerator {
   float maskChance;
   float deviation, randomOffset;//deviation from periodicity
   float currentSample;
+  Philox rng; //only used from the audio thread, seeded by the agent
 
   ImpulseGenerator() {
     setFrequency(1.0f);//one impulse per second
     setPhase(0.0f);//initialize phase to 0
     setDeviation(0.0f);//ensure periodicity
     setMaskChance(0.0f);//no missing impulses
-    randomOffset = rnd::uniform(-period*0.5, period*0.5) * deviation;
+    randomOffset = rng.uniform(-period*0.5, period*0.5) * deviation;
   }
 
   ImpulseGenerator(float initialFrequency) {
@@ -31,16 +37,16 @@ struct ImpulseGenerator {
     setPhase(0.0f);//initialize phase to 0
     setDeviation(0.0f);//ensure periodicity
     setMaskChance(0.0f);//no missing impulses
-    randomOffset = rnd::uniform(-period*0.5, period*0.5) * deviation;
+    randomOffset = rng.uniform(-period*0.5, period*0.5) * deviation;
   }
 
   float generateSample(){
     if(phase >= period+randomOffset){
-      float test = rnd::uniform(0.0f, 1.0f);
+      float test = rng.uniform(0.0f, 1.0f);
       if(test > maskChance){
         currentSample = 1.0f;
         float halfPeriod = period*0.5f;
-        randomOffset = rnd::uniform(-halfPeriod, halfPeriod) * deviation;
+        randomOffset = rng.uniform(-halfPeriod, halfPeriod) * deviation;
       }
       phase -= period;
     }else{
@@ -59,6 +65,7 @@ struct ImpulseGenerator {
   }
   void setMaskChance(float newMaskChance){maskChance = newMaskChance;}
   void setDeviation(float newDeviation){deviation = newDeviation;}
+  void seed(uint32_t s){rng.seed(s);}
 
   float getSample(){return currentSample;}
   float getFrequency(){return frequency;}
@@ -86,18 +93,19 @@ struct Chirplet {
 
   gam::Sine<float> osc; //one sine tone, from the Gamma library
 
-  Chirplet() { reset(); }
+  Chirplet() { reset(rnd::global()); }
 
-  void reset() {
-    centerFrequency = rnd::uniform(400.0f, 500.0f);
+  template <class RNG>
+  void reset(RNG& rng) {
+    centerFrequency = rng.uniform(400.0f, 500.0f);
     range = 4.0; //can only go one octave up or down
-    float rand = rnd::uniformS();
+    float rand = rng.uniformS();
     if (rand > 0) { up = true; } else { up = false; } // if it is positive, go upward. else, go downward
     if (up) { terminalFrequency = centerFrequency * range; } 
     else { terminalFrequency = centerFrequency / range; }
     //cout << "center: " << centerFrequency << " terminal: " << terminalFrequency << endl;
     //will go one octave above no matter what
-    duration = rnd::uniform(0.1, 0.3);
+    duration = rng.uniform(0.1, 0.3);
     // osc.freq((centerFrequency + range));
     durationInSamples = duration * 44100;
     frequencyIncrement = (terminalFrequency - centerFrequency)/durationInSamples;
@@ -186,107 +194,93 @@ struct Agent : Pose {
   float spikiness;
 
   //constructors
-  Agent() { reset(); } //constructor, initialize with a position and a forward
-  Agent(Vec3f p, Vec3f o, Vec3f m, Vec3f t, Vec3f c, float cF, float r, float d, bool dir, int nF, float s) { //everything that gets inherited
+  Agent() { reset(rnd::global()); } //constructor, initialize with a position and a forward
+  template <class RNG>
+  Agent(RNG& rng) { reset(rng); }
+  template <class RNG>
+  void reset(RNG& rng) { //give agents a pos and a forward
     isDead = false;
-    pos(p);
-    faceToward(o);
-    moveRate = m;
-    turnRate = t;
-    lifespan = rnd::uniform() * 10.0;
-    agentColor = Color(c.x, c.y, c.z, lifespan);
-    randomFlocking = Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS());
+    pos(Vec3f(rng.uniformS(), rng.uniformS(), rng.uniformS()));
+    faceToward(Vec3f(rng.uniformS(), rng.uniformS(), rng.uniformS()));
+    randomFlocking = Vec3f(rng.uniformS(), rng.uniformS(), rng.uniformS());
+    moveRate = Vec3f(rng.uniformS(), rng.uniformS(), rng.uniformS());
+    turnRate = Vec3f(rng.uniformS(), rng.uniformS(), rng.uniformS());
+    lifespan = rng.uniform() * 10.0;
+    agentColor = Color(rng.uniform(), rng.uniform(), rng.uniform(), lifespan);
     fitnessValue = 0.0;
-    startCheckingFitness = rnd::uniformS()*10;
+    startCheckingFitness = rng.uniformS()*10.0;
     canReproduce = false;
-    
+
     currentSample = 0.0f;
+    chirp.reset(rng);
     isChirping = false;
-    chirp.inherit(cF, r, d, dir);
-    impulse.setFrequency((1/chirp.duration) * rnd::uniform(0.1f, 1.0f)); // this is the only "unique" parameter the agents have sound-wise
-    impulse.setMaskChance(rnd::uniform(0.2, 0.8));
-    impulse.setDeviation(rnd::uniform(0.6, 0.9));
+    impulse.setFrequency((1/chirp.duration) * rng.uniform(0.1f, 1.0f)); //random breaks between impulses
+    impulse.setMaskChance(rng.uniform(0.2, 0.8));
+    impulse.setDeviation(rng.uniform(0.6, 0.9));
+    impulse.seed(rng());
 
-    faceCount = nF;
-    spikiness = s;
+    faceCount = (int)rng.uniform(1, 10);
+    spikiness = rng.uniform();
   }
-  void reset() { //give agents a pos and a forward
-    isDead = false;
-    pos(Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS()));
-    faceToward(Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS()));
-    randomFlocking = Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS());
-    moveRate = Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS());
-    turnRate = Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS());
-    lifespan = rnd::uniform() * 10.0;
-    agentColor = Color(rnd::uniform(), rnd::uniform(), rnd::uniform(), lifespan);
-    fitnessValue = 0.0;
-    startCheckingFitness = rnd::uniformS()*10.0;
-    canReproduce = false;
 
-    currentSample = 0.0f;
-    chirp.reset();
-    isChirping = false;
-    impulse.setFrequency((1/chirp.duration) * rnd::uniform(0.1f, 1.0f)); //random breaks between impulses
-    impulse.setMaskChance(rnd::uniform(0.2, 0.8));
-    impulse.setDeviation(rnd::uniform(0.6, 0.9));
+  // the simulation keeps its agents in an AgentStore (agent_store.cpp) -> everything an agent does lives there now
+  // an Agent is only used to make a new random agent and as a view of one slot of the store
+  // (offspring are made from a Genome, see below)
+};
 
-    faceCount = (int)rnd::uniform(1, 10);
-    spikiness = rnd::uniform();
-  }
+// ******
+// Genome
+// Everything an agent inherits from its two parents, plus where it is born
+// It is small and trivially copyable, so reproduce() can queue births without copying any sound state
+// ******
+struct Genome {
+  Vec3f position; //where the offspring is born
+  Vec3f facing; //the point it faces when it is born
+  Vec3f moveRate, turnRate;
+  Color color;
+  float centerFrequency, range, duration; //the chirplet
+  bool up;
+  int faceCount;
+  float spikiness;
+};
 
-  //getters and setters
-  float getLifespan() {  return lifespan;  }
-  void incrementLifespan(float amount) {
-    lifespan += amount;
-    agentColor.a = lifespan;
-  }
-  void incrementFitness(float value) {  fitnessValue += value;  }
-
-  // methods
-  bool checkReproduction(float reproductionProbabilityThreshold) {
-    canReproduce = false; // always false to start the round
-    if (lifespan < (rnd::uniform())) {
-      //roll for probability of reproduction
-      float reproductionProbability = rnd::uniform();
-      //cout << "fitness value: " << fitnessValue << endl;
-      reproductionProbability += fitnessValue; // boids with a greater fitness value have a higher reproductive chance
-      
-      //cout << reproductionProbability << " " << reproductionProbabilityThreshold << endl;
-      if (reproductionProbability > reproductionProbabilityThreshold) { //random chance to reproduce
-        canReproduce = true;
-        fitnessValue = fitnessValue * 0.9; // need to cut their fitness a bit because they have to take care of a "child"
-      }
-    }
-  }
+// **********
+// AgentVoice
+// The cold part of an agent: its sound and its looks
+// Only the audio thread (nextSample) and the renderers (setState) use it, so it lives in a side pool in the AgentStore
+// A birth re-initializes the voice in place (inherit) instead of copying a whole Agent over it
+// **********
+struct AgentVoice {
+  ImpulseGenerator impulse;
+  Chirplet chirp;
+  float currentSample = 0.0f;
+  bool isChirping = false; //the simulation doesn't kill an agent in the middle of a chirp
+  bool active = false; //false while the slot it belongs to is dead
 
-  void setDeathState() {
-    isDead = true;
-    pos() = Vec3f(0, 0, 0);
-    heading = Vec3f(0, 0 ,0);
-    center = Vec3f(0, 0, 0);
-    agentColor = Color(0 ,0 ,0, 0);
-    moveRate = Vec3f(0, 0, 0);
-    turnRate = Vec3f(0, 0, 0);
-    randomFlocking = Vec3f(0, 0, 0);
-    fitnessValue = 0;
-    startCheckingFitness = 0;
-    canReproduce = false;
-  }
+  Color color; //the alpha is the lifespan, which the AgentStore keeps
+  int faceCount = 1;
+  float spikiness = 0;
 
-  void evaluateFitness(float fitnessCutoff) {
-    if (lifespan < startCheckingFitness) {
-      //cout << "start checking fitness" << endl;
-      if (fitnessValue < fitnessCutoff)  {
-        //cout << "kill it, it is not fit" << endl;
-        lifespan = 0;
-      }
-    }
+  template <class RNG>
+  void inherit(const Genome& g, RNG& rng, float* window) { //everything that gets inherited
+    color = Color(g.color.r, g.color.g, g.color.b);
+    faceCount = g.faceCount;
+    spikiness = g.spikiness;
+
+    currentSample = 0.0f;
+    isChirping = false;
+    chirp.inherit(g.centerFrequency, g.range, g.duration, g.up);
+    chirp.setWindowPtr(window);
+    impulse.setFrequency((1/chirp.duration) * rng.uniform(0.1f, 1.0f)); // this is the only "unique" parameter the agents have sound-wise
+    impulse.setMaskChance(rng.uniform(0.2, 0.8));
+    impulse.setDeviation(rng.uniform(0.6, 0.9));
+    impulse.seed(rng());
+    active = true;
   }
 
   float nextSample() { //get the agent's sample -> chirplet's generateSample
     isChirping = chirp.active;
-    // currentSample = chirp.generateSample();
-    if(impulse.generateSample() == 1.0f) { // start new chirp
+    if (impulse.generateSample() == 1.0f) { // start new chirp
       chirp.active = true;
       chirp.windowPosition = 0.0f;
       chirp.osc.freq(chirp.centerFrequency);
@@ -296,18 +290,6 @@ struct Agent : Pose {
     }
     return currentSample;
   }
-
-  float randomCull(Vec3f cullPosition, float radius) { // how many agents get culled?
-    float cullingThreshold = 0.8;
-    float distance = (pos() - cullPosition).mag();
-
-    if (distance < radius) { //if within the culling radius, randomly kill
-      if (rnd::uniform() > cullingThreshold) {
-        lifespan = 0;
-        //cout << "culled" << endl;
-      }
-    }
-  }
 };
 
 //**************************
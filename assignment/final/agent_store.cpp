@@ -0,0 +1,409 @@
+/* agent_store.cpp
+ * Structure-of-arrays storage for the agents -> every agent attribute lives in its own contiguous array
+ * A flocking loop that only needs positions only streams the position arrays through the cache, not whole Agents
+ * (an Agent is a double precision Pose, a Chirplet with its oscillator, an ImpulseGenerator, genes and bookkeeping)
+ * Agent (agent.cpp) is only a view now: set(i, agent) scatters a freshly made agent into slot i, get(i) gathers one back out
+ * The cold part of every agent (its sound and looks, an AgentVoice) lives in a side pool, found through the slot's id (idOf)
+ * -> births (spawn) re-initialize the voice in place from a small Genome, nothing big gets copied
+ * The capacity is chosen at startup (init), and the pools only grow (grow) in chunks of CHUNK slots as they are needed
+ * Dead slots are kept on a free list -> a birth takes one (allocate) and a death gives one back (kill), both O(1)
+ * The live slots are kept in a dense list (alive), so the passes over the agents never have to look at a dead one
+ * sortByMorton() moves the live agents to the front of the arrays, in Z order (Morton order) of their positions
+ * -> agents that are near each other in space are near each other in memory, so the neighbor loops mostly hit the cache
+ * Sorting moves agents to other slots, so anything that has to find an agent again later keeps its id instead:
+ * idOf[slot] never changes for an agent (it is also where its voice is), slotOf[id] is where the agent is now
+ */
+
+#pragma once
+
+//c std library includes
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+//my includes
+#include "agent.cpp"
+#include "../common/parallel.cpp"
+
+using namespace al;
+using namespace std;
+
+struct AgentStore {
+  static const int CHUNK = 4096; // the pools grow by this many slots at a time
+  int size = 0; // how many agent slots there are right now
+  int capacity = 0; // the most slots there can ever be
+
+  //position and orientation -> the orientation is kept as a unit forward and a unit up vector instead of a quaternion
+  vector<float> px, py, pz;
+  vector<float> fx, fy, fz;
+  vector<float> ux, uy, uz;
+
+  //flocking attributes
+  vector<float> hx, hy, hz; // heading from POV of agent
+  vector<float> cx, cy, cz; // center of the neighbors
+  vector<unsigned> flockCount; // how many neighbors?
+
+  //genes -> these get inherited
+  vector<float> rx, ry, rz; // randomFlocking
+  vector<float> mx, my, mz; // moveRate
+  vector<float> tx, ty, tz; // turnRate
+
+  //evolution bookkeeping
+  vector<float> lifespan;
+  vector<float> fitnessValue;
+  vector<float> startCheckingFitness;
+  vector<int> cyclesBeforeAteFood;
+
+  //flags, one byte per agent per flag
+  vector<uint8_t> isDead;
+  vector<uint8_t> canReproduce;
+
+  //cold state: sound and looks
+  //the pool is allocated one chunk at a time and a voice never moves, because the audio thread reads it while the pool grows
+  vector<unique_ptr<AgentVoice[]>> voiceChunks; // reserved for the whole capacity up front, so it never reallocates
+  atomic<int> voiceChunkCount{0}; // how many chunks the audio thread may look at
+  vector<int> idOf; // the id of the agent in a slot -> its voice, and what to keep when the agent has to be found again after a sort
+  vector<int> slotOf; // where the agent with an id is now
+
+  vector<int> freeSlots; // the dead slots, the one at the back is handed out next
+  vector<int> alive; // the live slots, in no particular order -> iterate this instead of 0..size
+  vector<int> alivePosition; // where slot i is in alive, -1 if it is dead
+
+  void init(int initialSlots, int maxSlots) { // throw everything away, make room for initialSlots now and maxSlots at most
+    capacity = max(maxSlots, initialSlots);
+    size = 0;
+    voiceChunkCount.store(0, memory_order_release);
+    voiceChunks.clear();
+    voiceChunks.reserve((capacity + CHUNK - 1) / CHUNK);
+    idOf.clear();
+    slotOf.clear();
+    freeSlots.clear();
+    alive.clear();
+    alivePosition.clear();
+    grow(initialSlots);
+  }
+
+  bool grow(int slots) { // make room for at least this many slots (rounded up to a chunk, never past capacity), new slots are dead
+    if (slots <= size) { return true; }
+    if (size == capacity) { return false; }
+    int n = min(capacity, (slots + CHUNK - 1) / CHUNK * CHUNK);
+    for (vector<float>* v : {&px, &py, &pz, &fx, &fy, &fz, &ux, &uy, &uz, &hx, &hy, &hz, &cx, &cy, &cz,
+                             &rx, &ry, &rz, &mx, &my, &mz, &tx, &ty, &tz,
+                             &lifespan, &fitnessValue, &startCheckingFitness}) {
+      v->resize(n, 0.0f);
+    }
+    flockCount.resize(n, 0);
+    cyclesBeforeAteFood.resize(n, 0);
+    isDead.resize(n, 1);
+    canReproduce.resize(n, 0);
+    alivePosition.resize(n, -1);
+    while (int(voiceChunks.size()) * CHUNK < n) {
+      voiceChunks.emplace_back(new AgentVoice[CHUNK]);
+      voiceChunkCount.store(voiceChunks.size(), memory_order_release);
+    }
+    for (int i = size; i < n; i++) { idOf.push_back(i); slotOf.push_back(i); } // a birth in a slot reuses the slot's id and voice
+    for (int i = n - 1; i >= size; i--) { freeSlots.push_back(i); } // new slots are dead, the lowest is handed out first
+    size = n;
+    return true;
+  }
+
+  int allocate() { // a dead slot for a birth (the pools grow if there is none left), -1 if the capacity is full
+    if (freeSlots.empty() && !grow(size + 1)) { return -1; }
+    int i = freeSlots.back();
+    freeSlots.pop_back();
+    return i;
+  }
+
+  void kill(int i) { // agent i dies, its slot can be allocated again
+    setDeathState(i);
+    if (alivePosition[i] >= 0) { // swap-remove it from the alive list
+      int last = alive.back();
+      alive[alivePosition[i]] = last;
+      alivePosition[last] = alivePosition[i];
+      alive.pop_back();
+      alivePosition[i] = -1;
+    }
+    freeSlots.push_back(i);
+  }
+
+  void markAlive(int i) {
+    if (alivePosition[i] >= 0) { return; }
+    alivePosition[i] = alive.size();
+    alive.push_back(i);
+  }
+
+  void clear() { // forget every agent, nothing is alive and no slot is free (the caller sets or kills every slot after this)
+    for (int i : alive) { alivePosition[i] = -1; }
+    alive.clear();
+    freeSlots.clear();
+  }
+
+  AgentVoice& voice(int i) { int v = idOf[i]; return voiceChunks[v / CHUNK][v % CHUNK]; }
+  const AgentVoice& voice(int i) const { int v = idOf[i]; return voiceChunks[v / CHUNK][v % CHUNK]; }
+
+  template <class F>
+  void forEachVoice(F f) { // visit every voice in the pool -> safe from the audio thread while the simulation grows the pool
+    int chunks = voiceChunkCount.load(memory_order_acquire);
+    for (int c = 0; c < chunks; c++) {
+      AgentVoice* chunk = voiceChunks[c].get();
+      for (int v = 0; v < CHUNK; v++) { f(chunk[v]); }
+    }
+  }
+
+  //***********************************************************************
+  // Morton order
+
+  // 10 bits of each coordinate interleaved (x in the lowest bit) -> points close together mostly get close codes
+  static uint32_t mortonCode(uint32_t x, uint32_t y, uint32_t z) {
+    auto spread = [](uint32_t v) { // 10 bits -> every third bit
+      v &= 0x3ff;
+      v = (v | (v << 16)) & 0x030000ff;
+      v = (v | (v << 8)) & 0x0300f00f;
+      v = (v | (v << 4)) & 0x030c30c3;
+      v = (v | (v << 2)) & 0x09249249;
+      return v;
+    };
+    return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+  }
+
+  vector<uint64_t> sortKeys; // scratch for the sort
+  vector<int> order;
+  vector<float> floatScratch;
+  vector<int> intScratch;
+  vector<uint8_t> byteScratch;
+  vector<unsigned> unsignedScratch;
+
+  // move the live agents to slots 0..alive.size() in Morton order of their positions, the dead slots go after them
+  // every slot index changes -> anything keyed by slot (the neighbor table...) has to be rebuilt, ids stay the same
+  void sortByMorton() {
+    int n = alive.size();
+    if (n == 0) { return; }
+    //the box around the live agents
+    struct Box { Vec3f low, high; };
+    Box start = {position(alive[0]), position(alive[0])};
+    Box box = parallelReduce(n, 16384, start, [&](int begin, int end) {
+      Box b = start;
+      for (int k = begin; k < end; k++) {
+        int i = alive[k];
+        b.low.x = min(b.low.x, px[i]); b.low.y = min(b.low.y, py[i]); b.low.z = min(b.low.z, pz[i]);
+        b.high.x = max(b.high.x, px[i]); b.high.y = max(b.high.y, py[i]); b.high.z = max(b.high.z, pz[i]);
+      }
+      return b;
+    }, [](Box a, Box b) {
+      return Box{Vec3f(min(a.low.x, b.low.x), min(a.low.y, b.low.y), min(a.low.z, b.low.z)),
+                 Vec3f(max(a.high.x, b.high.x), max(a.high.y, b.high.y), max(a.high.z, b.high.z))};
+    });
+    Vec3f low = box.low, high = box.high;
+    float extent = max(max(high.x - low.x, high.y - low.y), max(high.z - low.z, 1e-6f));
+    if (!isfinite(extent)) { extent = 1; } // a NaN or infinite position -> those agents land in cell 0 below
+    float scale = 1023.0f / extent; // the same scale on every axis, so the cells are cubes
+    auto cell = [&](float v, float lowest) -> uint32_t { // 0..1023 along one axis (a float -> uint32_t cast out of range is UB)
+      float c = (v - lowest) * scale;
+      return isfinite(c) ? (uint32_t)min(max(c, 0.0f), 1023.0f) : 0;
+    };
+    sortKeys.resize(n);
+    for (int k = 0; k < n; k++) {
+      int i = alive[k];
+      uint32_t code = mortonCode(cell(px[i], low.x), cell(py[i], low.y), cell(pz[i], low.z));
+      sortKeys[k] = (uint64_t)code << 32 | (uint32_t)i; // the old slot breaks ties -> the same order every time
+    }
+    sort(sortKeys.begin(), sortKeys.end());
+
+    //order[new slot] = old slot: the live agents in Morton order, then the dead slots as they were
+    order.resize(size);
+    for (int k = 0; k < n; k++) { order[k] = sortKeys[k] & 0xffffffffu; }
+    int next = n;
+    for (int i = 0; i < size; i++) { if (alivePosition[i] < 0) { order[next++] = i; } }
+
+    auto permute = [&](auto& array, auto& scratch) {
+      scratch.resize(size);
+      for (int k = 0; k < size; k++) { scratch[k] = array[order[k]]; }
+      swap(array, scratch);
+    };
+    for (vector<float>* v : {&px, &py, &pz, &fx, &fy, &fz, &ux, &uy, &uz, &hx, &hy, &hz, &cx, &cy, &cz,
+                             &rx, &ry, &rz, &mx, &my, &mz, &tx, &ty, &tz,
+                             &lifespan, &fitnessValue, &startCheckingFitness}) {
+      permute(*v, floatScratch);
+    }
+    permute(cyclesBeforeAteFood, intScratch);
+    permute(idOf, intScratch);
+    permute(isDead, byteScratch);
+    permute(canReproduce, byteScratch);
+    permute(flockCount, unsignedScratch);
+
+    for (int k = 0; k < size; k++) { slotOf[idOf[k]] = k; }
+    for (int k = 0; k < n; k++) { alive[k] = k; alivePosition[k] = k; }
+    for (int k = n; k < size; k++) { alivePosition[k] = -1; }
+    freeSlots.clear();
+    for (int k = size - 1; k >= n; k--) { freeSlots.push_back(k); } // the lowest dead slot is handed out first
+  }
+
+  //***********************************************************************
+  // the Agent view
+
+  void set(int i, const Agent& a) { // scatter an agent into slot i
+    Vec3f p(a.pos()), f(a.uf()), u(a.uu());
+    px[i] = p.x; py[i] = p.y; pz[i] = p.z;
+    fx[i] = f.x; fy[i] = f.y; fz[i] = f.z;
+    ux[i] = u.x; uy[i] = u.y; uz[i] = u.z;
+    hx[i] = a.heading.x; hy[i] = a.heading.y; hz[i] = a.heading.z;
+    cx[i] = a.center.x; cy[i] = a.center.y; cz[i] = a.center.z;
+    flockCount[i] = a.flockCount;
+    rx[i] = a.randomFlocking.x; ry[i] = a.randomFlocking.y; rz[i] = a.randomFlocking.z;
+    mx[i] = a.moveRate.x; my[i] = a.moveRate.y; mz[i] = a.moveRate.z;
+    tx[i] = a.turnRate.x; ty[i] = a.turnRate.y; tz[i] = a.turnRate.z;
+    lifespan[i] = a.lifespan;
+    fitnessValue[i] = a.fitnessValue;
+    startCheckingFitness[i] = a.startCheckingFitness;
+    cyclesBeforeAteFood[i] = a.cyclesBeforeAteFood;
+    isDead[i] = a.isDead;
+    canReproduce[i] = a.canReproduce;
+
+    AgentVoice& v = voice(i);
+    v.color = Color(a.agentColor.r, a.agentColor.g, a.agentColor.b);
+    v.faceCount = a.faceCount;
+    v.spikiness = a.spikiness;
+    v.impulse = a.impulse;
+    v.chirp = a.chirp;
+    v.currentSample = a.currentSample;
+    v.isChirping = a.isChirping;
+    v.active = !a.isDead;
+    if (!a.isDead) { markAlive(i); }
+  }
+
+  template <class RNG>
+  void spawn(int i, const Genome& g, RNG& rng, float* window) { // a new agent is born into slot i
+    isDead[i] = false;
+    markAlive(i);
+    setPosition(i, g.position);
+    fx[i] = 0; fy[i] = 0; fz[i] = -1; // Pose's default orientation, then face toward the inherited point
+    ux[i] = 0; uy[i] = 1; uz[i] = 0;
+    faceToward(i, g.facing);
+    hx[i] = hy[i] = hz[i] = 0;
+    cx[i] = cy[i] = cz[i] = 0;
+    flockCount[i] = 1;
+    mx[i] = g.moveRate.x; my[i] = g.moveRate.y; mz[i] = g.moveRate.z;
+    tx[i] = g.turnRate.x; ty[i] = g.turnRate.y; tz[i] = g.turnRate.z;
+    lifespan[i] = rng.uniform() * 10.0;
+    rx[i] = rng.uniformS(); ry[i] = rng.uniformS(); rz[i] = rng.uniformS();
+    fitnessValue[i] = 0.0;
+    startCheckingFitness[i] = rng.uniformS()*10;
+    canReproduce[i] = false;
+    cyclesBeforeAteFood[i] = 0;
+
+    voice(i).inherit(g, rng, window);
+  }
+
+  Agent get(int i) const { // gather slot i back into an agent (a copy, writing to it doesn't change the store)
+    Agent a;
+    a.pos(position(i));
+    a.quat().fromCoordinateFrame(Vec3d(up(i).cross(-forward(i))), Vec3d(up(i)), Vec3d(-forward(i)));
+    a.heading = heading(i);
+    a.center = center(i);
+    a.flockCount = flockCount[i];
+    a.randomFlocking = randomFlocking(i);
+    a.moveRate = moveRate(i);
+    a.turnRate = turnRate(i);
+    a.lifespan = lifespan[i];
+    a.fitnessValue = fitnessValue[i];
+    a.startCheckingFitness = startCheckingFitness[i];
+    a.cyclesBeforeAteFood = cyclesBeforeAteFood[i];
+    a.isDead = isDead[i];
+    a.canReproduce = canReproduce[i];
+
+    const AgentVoice& v = voice(i);
+    a.agentColor = color(i);
+    a.faceCount = v.faceCount;
+    a.spikiness = v.spikiness;
+    a.impulse = v.impulse;
+    a.chirp = v.chirp;
+    a.currentSample = v.currentSample;
+    a.isChirping = v.isChirping;
+    return a;
+  }
+
+  Vec3f position(int i) const { return Vec3f(px[i], py[i], pz[i]); }
+  Vec3f forward(int i) const { return Vec3f(fx[i], fy[i], fz[i]); }
+  Vec3f up(int i) const { return Vec3f(ux[i], uy[i], uz[i]); }
+  Vec3f heading(int i) const { return Vec3f(hx[i], hy[i], hz[i]); }
+  Vec3f center(int i) const { return Vec3f(cx[i], cy[i], cz[i]); }
+  Vec3f randomFlocking(int i) const { return Vec3f(rx[i], ry[i], rz[i]); }
+  Vec3f moveRate(int i) const { return Vec3f(mx[i], my[i], mz[i]); }
+  Vec3f turnRate(int i) const { return Vec3f(tx[i], ty[i], tz[i]); }
+  Color color(int i) const { const Color& c = voice(i).color; return Color(c.r, c.g, c.b, lifespan[i]); }
+
+  void setPosition(int i, Vec3f p) { px[i] = p.x; py[i] = p.y; pz[i] = p.z; }
+
+  //***********************************************************************
+  // what used to be Agent's methods
+
+  void incrementLifespan(int i, float amount) { lifespan[i] += amount; }
+  void incrementFitness(int i, float value) { fitnessValue[i] += value; }
+
+  template <class RNG>
+  bool checkReproduction(int i, float reproductionProbabilityThreshold, RNG& rng) {
+    canReproduce[i] = false; // always false to start the round
+    if (lifespan[i] < (rng.uniform())) {
+      //roll for probability of reproduction
+      float reproductionProbability = rng.uniform();
+      reproductionProbability += fitnessValue[i]; // boids with a greater fitness value have a higher reproductive chance
+
+      if (reproductionProbability > reproductionProbabilityThreshold) { //random chance to reproduce
+        canReproduce[i] = true;
+        fitnessValue[i] = fitnessValue[i] * 0.9; // need to cut their fitness a bit because they have to take care of a "child"
+      }
+    }
+    return canReproduce[i];
+  }
+
+  void evaluateFitness(int i, float fitnessCutoff) {
+    if (lifespan[i] < startCheckingFitness[i]) {
+      if (fitnessValue[i] < fitnessCutoff) { // kill it, it is not fit
+        lifespan[i] = 0;
+      }
+    }
+  }
+
+  void setDeathState(int i) {
+    isDead[i] = true;
+    px[i] = py[i] = pz[i] = 0;
+    hx[i] = hy[i] = hz[i] = 0;
+    cx[i] = cy[i] = cz[i] = 0;
+    voice(i).color = Color(0, 0, 0);
+    voice(i).active = false; // the audio thread stops playing it
+    lifespan[i] = min(lifespan[i], 0.0f); // the color alpha is the lifespan, a dead agent is invisible
+    mx[i] = my[i] = mz[i] = 0;
+    tx[i] = ty[i] = tz[i] = 0;
+    rx[i] = ry[i] = rz[i] = 0;
+    fitnessValue[i] = 0;
+    startCheckingFitness[i] = 0;
+    canReproduce[i] = false;
+  }
+
+  void randomCull(int i, float chance) { // agent i is inside a cull -> it dies some of the time (chance is a random number in [0, 1))
+    float cullingThreshold = 0.8;
+    if (chance > cullingThreshold) {
+      lifespan[i] = 0;
+    }
+  }
+
+  // rotate agent i so it faces toward a point (same as Pose::faceToward, on the forward/up vectors in float)
+  void faceToward(int i, Vec3f point) {
+    Vec3f target = point - position(i);
+    float length = target.mag();
+    if (length < 1e-12f) { return; }
+    target /= length;
+    Vec3f f = forward(i);
+    Vec3f u = up(i);
+    float c = f.dot(target); // cosine of the rotation angle
+    if (c > -0.9999f) { // rotate up by the shortest rotation that takes forward to target (Rodrigues)
+      Vec3f v = f.cross(target);
+      u = u * c + v.cross(u) + v * (v.dot(u) / (1.0f + c));
+    } // else: forward flips, turning half way around up leaves up where it is
+    u = (u - target * u.dot(target)).normalize(); // keep up orthogonal to forward, so the error doesn't build up
+    fx[i] = target.x; fy[i] = target.y; fz[i] = target.z;
+    ux[i] = u.x; uy[i] = u.y; uz[i] = u.z;
+  }
+};
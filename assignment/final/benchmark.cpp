@@ -0,0 +1,186 @@
+/* benchmark.cpp
+ * Per-phase microbenchmark of the simulation step (simulation.cpp)
+ * For every agent/food count it builds a fresh simulation, runs a few warm-up steps, and then runs the phases of
+ * --steps more steps one at a time (Simulation::runPhase), timing each phase on its own
+ * It reports ns per agent for every phase and a scaling exponent between neighbouring counts
+ * (~1 means the phase scales linearly, ~2 means quadratically), so we can see which phase stops scaling first
+ * It then times --steps whole steps (Simulation::step, the phases as a task graph) -> against the sum of the phases,
+ * that shows what running independent phases side by side buys
+ * The header row prints the configuration every run used (threads, grid, flocking kernel, ...), and the csv carries it too
+ *
+ * Usage: benchmark [--agents 500,5000,...] [--food 500,5000,...] [--steps N] [--warmup N] [--csv file] [simulation options]
+ *   the agent counts are swept with the first food count, the food counts are swept with the first agent count
+ *   every other simulation option (SimulationConfig, e.g. --capacity, --threads, --config) applies to every run of the sweep,
+ *   except agents and food, which the sweep sets
+ *   every simulation is seeded (default seed 1), so two benchmark runs time exactly the same workload
+ */
+
+//c std library includes
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+//my includes
+#include "simulation.cpp"
+
+using namespace std;
+
+struct BenchmarkResult {
+  int agents;
+  int food;
+  double nsPerStep[Simulation::PHASE_COUNT]; // average time of every phase in one step
+  double stepNs; // average time of a whole step() (the task graph)
+};
+
+vector<int> parseCounts(const char* list) { // "500,5000,50000" -> {500, 5000, 50000}
+  vector<int> counts;
+  string s(list);
+  size_t start = 0;
+  while (start < s.size()) {
+    size_t end = s.find(',', start);
+    if (end == string::npos) { end = s.size(); }
+    counts.push_back(atoi(s.substr(start, end - start).c_str()));
+    start = end + 1;
+  }
+  return counts;
+}
+
+BenchmarkResult runBenchmark(SimulationConfig config, int agents, int food, int warmup, int steps) {
+  BenchmarkResult result;
+  result.agents = agents;
+  result.food = food;
+  for (int p = 0; p < Simulation::PHASE_COUNT; p++) { result.nsPerStep[p] = 0; }
+
+  config.agents = agents;
+  config.food = food;
+  unique_ptr<Simulation> simulation(new Simulation(config));
+  simulation->reset();
+  for (int i = 0; i < warmup; i++) { simulation->step(1.0 / 60.0); }
+
+  for (int i = 0; i < steps; i++) { // same as Simulation::step, but with a timer around every phase
+    simulation->beginStep(1.0 / 60.0);
+    for (int p = 0; p < Simulation::PHASE_COUNT; p++) {
+      auto start = chrono::steady_clock::now();
+      simulation->runPhase(Simulation::Phase(p));
+      result.nsPerStep[p] += chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    }
+  }
+  for (int p = 0; p < Simulation::PHASE_COUNT; p++) { result.nsPerStep[p] /= steps; }
+
+  //the same steps again on a fresh copy of the run (same seed -> the same workload), this time as whole steps
+  simulation.reset(new Simulation(config));
+  simulation->reset();
+  for (int i = 0; i < warmup; i++) { simulation->step(1.0 / 60.0); }
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < steps; i++) { simulation->step(1.0 / 60.0); }
+  result.stepNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / steps;
+  return result;
+}
+
+// prints ns/agent for every phase (rows) and count (columns), then the scaling exponent between neighbouring counts
+void printSweep(const char* title, const vector<BenchmarkResult>& results, bool byFood) {
+  if (results.empty()) { return; }
+  printf("\n%s\n%-22s", title, "ns/agent");
+  for (const BenchmarkResult& r : results) { printf("%12d", byFood ? r.food : r.agents); }
+  printf("   | scaling exponent\n");
+
+  for (int p = 0; p < Simulation::PHASE_COUNT; p++) {
+    printf("%-22s", Simulation::phaseName(Simulation::Phase(p)));
+    for (const BenchmarkResult& r : results) { printf("%12.1f", r.nsPerStep[p] / r.agents); }
+    printf("   |");
+    for (int i = 1; i < (int)results.size(); i++) {
+      double n0 = byFood ? results[i - 1].food : results[i - 1].agents;
+      double n1 = byFood ? results[i].food : results[i].agents;
+      double t0 = results[i - 1].nsPerStep[p];
+      double t1 = results[i].nsPerStep[p];
+      if (t0 > 0 && t1 > 0 && n1 != n0) { printf(" %5.2f", log(t1 / t0) / log(n1 / n0)); }
+      else { printf("     -"); }
+    }
+    printf("\n");
+  }
+
+  printf("%-22s", "total (ms/step)");
+  for (const BenchmarkResult& r : results) {
+    double total = 0;
+    for (int p = 0; p < Simulation::PHASE_COUNT; p++) { total += r.nsPerStep[p]; }
+    printf("%12.3f", total / 1e6);
+  }
+  printf("\n%-22s", "step() (ms/step)");
+  for (const BenchmarkResult& r : results) { printf("%12.3f", r.stepNs / 1e6); }
+  printf("\n");
+}
+
+// one row per phase (and one for the whole step), the configuration in the last column -> csvs of several runs can be concatenated
+void writeCsv(ofstream& csv, const char* sweep, const vector<BenchmarkResult>& results, const string& configuration) {
+  for (const BenchmarkResult& r : results) {
+    for (int p = 0; p <= Simulation::PHASE_COUNT; p++) {
+      const char* name = p < Simulation::PHASE_COUNT ? Simulation::phaseName(Simulation::Phase(p)) : "step";
+      double ns = p < Simulation::PHASE_COUNT ? r.nsPerStep[p] : r.stepNs;
+      csv << sweep << "," << r.agents << "," << r.food << "," << name << "," << ns << "," << ns / r.agents << ",\"" << configuration << "\"\n";
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  vector<int> agentCounts = {500, 1000, 5000, 10000, 50000, 100000, 500000, 1000000};
+  vector<int> foodCounts = {500, 1000, 5000, 10000, 50000};
+  int steps = 10;
+  int warmup = 2;
+  const char* csvPath = nullptr;
+  SimulationConfig config;
+  config.seed = 1;
+  config.seeded = true;
+  bool ok = true;
+  for (int i = 1; i < argc; i++) {
+    //the sweep's own options first, --agents and --food are lists here
+    if (strcmp(argv[i], "--agents") == 0 && i + 1 < argc) { agentCounts = parseCounts(argv[++i]); }
+    else if (strcmp(argv[i], "--food") == 0 && i + 1 < argc) { foodCounts = parseCounts(argv[++i]); }
+    else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc) { steps = atoi(argv[++i]); }
+    else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) { warmup = atoi(argv[++i]); }
+    else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) { csvPath = argv[++i]; }
+    else if (!config.parseArg(argc, argv, i, ok)) { ok = false; }
+  }
+  if (!ok || !config.valid()) {
+    cerr << "usage: " << argv[0] << " [--agents 500,5000,...] [--food 500,5000,...] [--steps N] [--warmup N] [--csv file] " << SimulationConfig::usage() << endl;
+    return 1;
+  }
+  if (agentCounts.empty() || foodCounts.empty() || steps < 1) {
+    cerr << "need at least one agent count, one food count and one step" << endl;
+    return 1;
+  }
+
+  vector<BenchmarkResult> agentSweep;
+  for (int agents : agentCounts) {
+    cerr << "agents " << agents << ", food " << foodCounts[0] << "..." << endl;
+    agentSweep.push_back(runBenchmark(config, agents, foodCounts[0], warmup, steps));
+  }
+  vector<BenchmarkResult> foodSweep;
+  for (int food : foodCounts) {
+    cerr << "agents " << agentCounts[0] << ", food " << food << "..." << endl;
+    foodSweep.push_back(runBenchmark(config, agentCounts[0], food, warmup, steps));
+  }
+
+  SimulationConfig shown = config; // what every run used, with the sweep's first counts
+  shown.agents = agentCounts[0];
+  shown.food = foodCounts[0];
+  string configuration = shown.describe();
+  printf("config: %s\n", configuration.c_str());
+  string agentTitle = "agent sweep (food = " + to_string(foodCounts[0]) + ")";
+  string foodTitle = "food sweep (agents = " + to_string(agentCounts[0]) + ")";
+  printSweep(agentTitle.c_str(), agentSweep, false);
+  printSweep(foodTitle.c_str(), foodSweep, true);
+
+  if (csvPath) {
+    ofstream csv(csvPath);
+    csv << "sweep,agents,food,phase,ns_per_step,ns_per_agent,config\n";
+    writeCsv(csv, "agents", agentSweep, configuration);
+    writeCsv(csv, "food", foodSweep, configuration);
+  }
+  return 0;
+}
@@ -1,12 +1,20 @@
 /* field.cpp, written by Stejara Dinulescu
  * This file describes the properties of the environmental field
  * A field object contains food (described in separate struct) and directional forces set up in a grid to move the agents
+ * The food is a fixed pool of foodCapacity: eaten food is swap-removed at the end of the frame, and respawned food never goes past the capacity
+ * foodGrid finds the food near a point -> it is rebuilt (indexFood) the first time it is needed after the food moved or changed
+ * The forces are the velocity of a fluid (fluid.cpp), sampled with trilinear interpolation (sampleForces) and stepped by updateFluid
+ * or, when a flow volume is open, precomputed flow streamed from disk (flow_volume.cpp)
  */
 #pragma once 
 
 #include "al/math/al_Random.hpp"
+#include <algorithm>
 #include <fstream>
 #include <vector>
+#include "flow_volume.cpp"
+#include "fluid.cpp"
+#include "spatial_grid.cpp"
 using namespace al;
 using namespace std;
 
@@ -20,13 +28,14 @@ struct Food { //food in the field
   bool isConsumed = false;
 
   //Food constructor
-  Food() {  reset();  }
-
-  void reset() {
-    color = Color(rnd::uniform(), rnd::uniform(), rnd::uniform());
-    size = rnd::uniform(); //at least a size of 1
-    position = Vec3f( rnd::uniformS(), rnd::uniformS(), rnd::uniformS()  );
-    velocity = Vec3f(  rnd::uniformS(), rnd::uniformS(), rnd::uniformS()  ) * 0.001;
+  Food() {  reset(rnd::global());  }
+  Food(rnd::Random<>& rng) {  reset(rng);  }
+
+  void reset(rnd::Random<>& rng) {
+    color = Color(rng.uniform(), rng.uniform(), rng.uniform());
+    size = rng.uniform(); //at least a size of 1
+    position = Vec3f( rng.uniformS(), rng.uniformS(), rng.uniformS()  );
+    velocity = Vec3f(  rng.uniformS(), rng.uniformS(), rng.uniformS()  ) * 0.001;
   }
 
   void setSize(int s) { size = s; }
@@ -37,35 +46,36 @@ struct Food { //food in the field
 };
 
 struct Field { // field struct
+  int initialAmountOfFood = 500; // how much food the field starts with
+  int foodCapacity = 500; // the most food there can ever be in the field
   int amountOfFood = 500;
-  vector<Food> food;
-
-  int side; // how many sides is the field
-  vector<Vec3f> fluidForces;
-  vector<float> dampingFactors;
-
-  // initialize
-  void make(int s) {
-    side = s;
-    for (int i = 0; i < side*side*side; i++) {
-      Vec3f randomFluidForce = Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS());
-      fluidForces.push_back(randomFluidForce);
-      dampingFactors.push_back(rnd::uniform());
-    }
-  }
+  vector<Food> food; // the live food, packed -> never grows past foodCapacity, so it never reallocates after the first reset
+  vector<int> eaten; // the food consumed this frame, removed in updateFood
+  SpatialGrid foodGrid; // the food indices by position
+  bool foodGridDirty = true; // the food moved, or some was added or removed, since foodGrid was built
+
+  Fluid fluid; // the forces
+  FlowVolume volume; // the forces instead of the fluid, if it is open
+
+  rnd::Random<> rng; // everything random in the food comes from here, the simulation seeds it
+  rnd::Random<> fluidRng; // and in the fluid -> its own, so the fluid can step while the food phases run
 
   void initializeFood() { // initialize a food particle, push it into a vector
     food.clear();
-    food.resize(0);
+    food.reserve(foodCapacity);
+    eaten.clear();
+    amountOfFood = min(initialAmountOfFood, foodCapacity);
     for (int i = 0; i < amountOfFood; i++) {
-      Food f;
+      Food f(rng);
       food.push_back(f);
     }
+    foodGridDirty = true;
   }
 
   void resetField() { // initialize all things in the field
     //cout << "init field..." << endl;
-    make(3);
+    if (volume.isOpen()) { volume.restart(); }
+    else { fluid.make(fluid.side, fluidRng); }
     initializeFood();
     //cout << "field is initialized!" << endl;
   }
@@ -75,24 +85,42 @@ struct Field { // field struct
     for (int i = 0; i < food.size(); i++) {
         food[i].position += food[i].velocity; //moving at constant vel
     }
+    foodGridDirty = true;
+  }
+
+  void indexFood(float cellSize) { // make sure foodGrid is up to date, with cells at least as big as the distance you will look around
+    if (!foodGridDirty && cellSize == foodGrid.cellSize) { return; }
+    foodGrid.build(food.size(), cellSize, [](int i) { return i; }, [&](int i) { return food[i].position; });
+    foodGridDirty = false;
+  }
+
+  void consume(int i) { // an agent ate food i -> it stays in place until updateFood, so other agents can still eat it this frame
+    if (food[i].isConsumed) { return; }
+    food[i].isConsumed = true;
+    eaten.push_back(i);
   }
 
   void updateFood() { // has the food been consumed by an agent?
-    for (int i = 0; i < food.size(); i++) {
-      if (food[i].isConsumed) { //if the food is consumed, remove it from the vector
-        food.erase(food.begin() + i);
-      }
+    //swap-remove every eaten food, the highest index first so the ones moved into the holes are never eaten ones
+    sort(eaten.begin(), eaten.end(), greater<int>());
+    for (int i : eaten) {
+      food[i] = food.back();
+      food.pop_back();
     }
+    if (!eaten.empty()) { foodGridDirty = true; }
+    eaten.clear();
     amountOfFood = food.size();
   }
 
   void addFood() { // add food if there isn't enough food in teh environment
-    int foodToAdd = rnd::uniform() * 100;
+    int foodToAdd = rng.uniform() * 100;
+    foodToAdd = min(foodToAdd, foodCapacity - (int)food.size()); // the pool is full
     //cout << "adding " << foodToAdd << " food!" << endl;
     for (int i = 0; i < foodToAdd; i++) {
-      Food f;
+      Food f(rng);
       food.push_back(f);
     }
+    if (foodToAdd > 0) { foodGridDirty = true; }
     //cout << "new food size: " << food.size() << endl;
   }
 
@@ -101,23 +129,17 @@ struct Field { // field struct
   }
 
   //Fluid Simulation
-  int findGridBlock(Vec3f position) {
-    float index = abs(position.x + position.y + position.z);
-    index *= 10;
-    int i = index;
-    //cout << i << endl;
-    return i;
+  // the force at the positions of ids (x[id], y[id], z[id]) -> out*[k] for ids[k]
+  // every position is blended from the 8 grid points around it, the same work per agent no matter how fine the grid is
+  void sampleForces(const vector<int>& ids, const float* x, const float* y, const float* z,
+                    float* outX, float* outY, float* outZ) const {
+    if (volume.isOpen()) { volume.sample(ids, x, y, z, outX, outY, outZ); }
+    else { fluid.sample(ids, x, y, z, outX, outY, outZ); }
   }
 
-  Vec3f getForceVector(int index) { return fluidForces[index]; }
-  void dampForces() {
-    for (int i = 0; i < fluidForces.size(); i++) {
-      if (fluidForces[i].mag() > 0.1) {
-        fluidForces[i] = fluidForces[i] * dampingFactors[i];
-      } else {
-        fluidForces[i] = Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS()); //reset the fluid force
-      }
-    }
+  void updateFluid(float dt) { // play the volume on, or stir, diffuse, advect and project the fluid
+    if (volume.isOpen()) { volume.advance(dt); }
+    else { fluid.step(dt, fluidRng); }
   }
 };
 
@@ -7,23 +7,32 @@
  * Basic structure of the Agent: size/shape, lifespan, flocking parameters, color, chirplet sound, fitness value
  * 
  * Using: AlloLib and Gamma by the AlloSphere Research Group, Cuttlebone by Karl Yerkes
- * Suporting files: field.cpp, agent.cpp, state.cpp
+ * Suporting files: simulation.cpp, field.cpp, agent.cpp, state.cpp, trace.cpp, triple_buffer.cpp
+ * Run with --agents N --capacity N --food N (or --config file) to size the simulation, see SimulationConfig in simulation.cpp
+ *   only the first MAX_AGENT_NUM live agents and MAX_FOOD_NUM food are sent to the renderers (state.cpp)
+ * Run with --seed N for a reproducible population (the audio thread still decides when agents are chirping, so only the headless runner is bit-identical)
+ * Press 't' to write the last few seconds of tracing zones to trace.json (open it in chrome://tracing)
+ * On the simulating machine the simulation runs on its own thread: while a frame is drawn, the next step is already being simulated,
+ *   the finished steps come over through a TripleBuffer (triple_buffer.cpp), so a slow step holds the picture instead of dropping frames
  */
   
 //allolib includes
 #include "al/app/al_DistributedApp.hpp"
 #include "al/math/al_Random.hpp"
 #include "al/ui/al_ControlGUI.hpp"
-#include "al/spatial/al_HashSpace.hpp"
 //cuttlebone includes
 #include "al_ext/statedistribution/al_CuttleboneStateSimulationDomain.hpp"
 //c std library includes
+#include <condition_variable>
 #include <fstream>
+#include <mutex>
+#include <thread>
 #include <vector>
 //my includes
-#include "agent.cpp"
+#include "simulation.cpp"
 #include "state.cpp"
-#include "field.cpp"
+#include "trace.cpp"
+#include "triple_buffer.cpp"
 
 //namespaces
 using namespace al;
@@ -31,23 +40,27 @@ using namespace std;
 
 // forward declarations of some functions
 string slurp(string fileName); 
-HashSpace space(6, MAX_AGENT_NUM);
 
 // Distributed app allows us to structure our program and run it in multiple windows (i.e. "renderers") in the sphere
 // SharedState (the state described by state.cpp) contains everything that is passed to the renderers for drawing
 // Everything that isn't in shared state is needed for the simulation, which happens only on one machine
+// The simulation itself lives in simulation.cpp -> this app only feeds it the gui params, steps it, and draws/sonifies it
 class MyApp : public DistributedAppWithState<SharedState>  {
   //global vars/containers
-  Agent agents[MAX_AGENT_NUM]; // data structure that stores the agents in the system
-  vector<Agent> tempNewAgents; // this a temporary vector that holds all the new agents that are to be added in the system after reproduction
-  // if there is space is the agents array, new agents are added frmo the tempNewAgents vector in the order that they were created
-  Field field; // field
-  float hanningWindow[1024]; //this is the hanning window passed to each agent for their chirplet sound
+  Simulation simulation; // the agents, the field, and all the flocking/evolution logic -> only the simulation thread touches it after onCreate
   // misc
   bool freeze = false; // flag that freezes the whole system on a keypress (spacebar)
-  float timing = rnd::uniform(1,1000); // how often does the culling happen from the environment?
-  const float FITNESS_CUTOFF = 100.0; // what is the cutoff for a "fit" agent?
-  unsigned counter = 0;
+
+  //the simulation thread -> every onAnimate asks it for one step, and takes the newest step it finished
+  thread simulationThread;
+  TripleBuffer<SimulationFrame> frames;
+  mutex stepLock; // guards the request below
+  condition_variable stepWanted;
+  int stepsWanted = 0; // steps onAnimate asked for that the simulation thread hasn't started
+  double stepDt = 0;
+  SimulationParams stepParams; // the gui params for the next step
+  bool resetWanted = false;
+  bool quitSimulation = false;
   
   //Gui params
   //flocking params
@@ -93,6 +106,8 @@ class MyApp : public DistributedAppWithState<SharedState>  {
 
   void initGuiAndPassParams() { // initializes gui, passes in the params
     //gui
+    aliveAgents.max(simulation.agents.capacity); // the capacity is only known at startup
+    aliveAgents.set(simulation.initialAgents);
     gui << backgroundColor << rate << size << ratio << localRadius << k 
         << reproductionDistanceThreshold << foodDistanceThreshold 
         << decreaseLifespanAmount << reproductionProbabilityThreshold 
@@ -100,22 +115,20 @@ class MyApp : public DistributedAppWithState<SharedState>  {
     gui.init();
   }
 
-  void initAgents() { // initialize agents
-    for (int i = 0; i < MAX_AGENT_NUM; i++) {
-      Agent a;
-      agents[i] = a;
-
-      space.move(i, a.pos() * space.dim()); //push agents into the hash space
-      
-      agentMesh.vertex(a.pos());
-      agentMesh.normal(a.uf());
-      const Vec3f& up(a.uu());
-      agentMesh.color(a.agentColor);
-      agentMesh.texCoord(a.faceCount, a.spikiness);
+  void initAgentMesh() { // initialize the agent mesh with the agent array
+    AgentStore& agents = simulation.agents;
+    int count = min((int)agents.alive.size(), MAX_AGENT_NUM);
+    for (int k = 0; k < count; k++) {
+      int i = agents.alive[k];
+      agentMesh.vertex(agents.position(i));
+      agentMesh.normal(agents.forward(i));
+      agentMesh.color(agents.color(i));
+      agentMesh.texCoord(agents.voice(i).faceCount, agents.voice(i).spikiness);
     }
   }
 
   void initFoodMesh() { //initialize food
+    Field& field = simulation.field;
     for(int i = 0; i < field.getAmountOfFood(); i++) {
       foodMesh.vertex(field.food[i].getPosition());
       foodMesh.color(field.food[i].getColor());
@@ -123,11 +136,22 @@ class MyApp : public DistributedAppWithState<SharedState>  {
     }
   }
 
+  void syncParams(SimulationParams& params) { // copy the gui params into params (stepParams, the simulation thread takes them from there)
+    params.k = k;
+    params.localRadius = localRadius;
+    params.rate = rate;
+    params.reproductionDistanceThreshold = reproductionDistanceThreshold;
+    params.foodDistanceThreshold = foodDistanceThreshold;
+    params.decreaseLifespanAmount = decreaseLifespanAmount;
+    params.reproductionProbabilityThreshold = reproductionProbabilityThreshold;
+  }
+
   //***********************************************************************
   //onCreate
 
   void onCreate() override {
     // initialize everything
+    TRACE_THREAD_NAME("main");
     initCuttlebone();
     initGuiAndPassParams();
     navControl().useMouse(false);
@@ -145,19 +169,17 @@ class MyApp : public DistributedAppWithState<SharedState>  {
     foodMesh.primitive(Mesh::POINTS);
     cullMesh.primitive(Mesh::POINTS);
 
-    field.resetField(); //initializes the field (fills the food array, initializes forces)
+    simulation.reset(); //initializes the agents and the field (fills the food array, initializes forces)
     initFoodMesh(); //init the food mesh with food vector
-    initAgents(); //init the agent mesh with agent array
+    initAgentMesh(); //init the agent mesh with agent array
 
     nav().pos(0, 0, 3);
 
-    //fill the hanning window, pass it to each agent
-    for (int i = 0; i < 1024; i++) {
-      hanningWindow[i] = 0.5f * (1.0f - cos((2.0f * 3.1415926 * (i/1024.0f)))/1.0f);
-    }
-    for (int i = 0; i < MAX_AGENT_NUM; i++) {
-      agents[i].chirp.setWindowPtr(hanningWindow);
+    if (cuttleboneDomain && cuttleboneDomain->isSender()) { // only the simulating machine simulates
+      stepParams = simulation.params;
+      simulationThread = thread([this]() { simulate(); });
     }
+
     //set sample rate for audio
     gam::sampleRate(audioIO().framesPerSecond());
   }
@@ -165,235 +187,50 @@ class MyApp : public DistributedAppWithState<SharedState>  {
   //***********************************************************************
   //Everything needed for onAnimate()
 
-  void eatFood() { // if the agent is at a specific location in the environment and finds food, then increase it's lifespan
-    for (int i = 0; i < MAX_AGENT_NUM; i++) { //check each of the agents
-      if (agents[i].isDead) { continue; }
-      bool foundFood = false;
-      for (int j = 0; j < field.getAmountOfFood(); j++) { //check each of the food particles
-        if (foundFood) { continue; } // don't do anything if that agent already ate food
-        float distance = Vec3f(agents[i].pos() - field.food[j].getPosition()).mag();
-        if (distance < foodDistanceThreshold) { //if the agent is this close to the food particle
-          //cout << "food @ index " << i << " consumed!" << endl;
-          field.food[j].isConsumed = true;
-          agents[i].incrementLifespan(field.food[j].getSize()); //increase agent's lifespan by the food size
-          agents[i].cyclesBeforeAteFood = 0; // reset food cycle counter
-          foundFood = true;
-        } else { } //increment cycles counter
-      }
-
-      if (foundFood == false) { agents[i].cyclesBeforeAteFood++; }
-    }
-  }
-
-  void respawnFood() { // potential future TO DO: only respawn food if something is triggered in the environment
-    int foodThreshold = 250;
-    if (field.getAmountOfFood() < foodThreshold) { //if there are less than X food particles in the field
-    //cout << "food is under " << foodThreshold << endl;
-      field.addFood();
-    }
-  }
-
-  void applyForces() { //apply the field force on the agents located in that area
-    //take an agent, find out the grid space that it is in
-    for (int i = 0; i < MAX_AGENT_NUM; i++) {
-      if (agents[i].isDead) { continue; }
-      int index = field.findGridBlock(agents[i].pos()); //find the grid that it is in
-      //cout << index << endl;
-      Vec3f forceField = field.getForceVector(index); //get the force vector to apply to the agent
-      agents[i].pos(agents[i].pos() + forceField * rate);
-    }
-    field.dampForces(); // damp the forces a bit, otherwise, you can't see the flocking
+  void updateCullMesh(const SimulationFrame& frame) { //add the last cull to the mesh -> this is only if we want to visualize this culling
+    cullMesh.reset();
+    cullMesh.vertex(frame.cullPosition);
+    cullMesh.color(frame.cullColor);
+    cullMesh.texCoord(frame.cullRadius, 0);
   }
 
-  //reproduce between two boids
-  void reproduce() { 
-    for (int i = 0; i < MAX_AGENT_NUM; i++) {
-      if (agents[i].isDead) { continue; }
-      agents[i].checkReproduction(reproductionProbabilityThreshold); // check if the agents are able to reproduce (probability based)
-      if (agents[i].canReproduce) { // if they can reproduce,
-        //check nearest neighbor
-        HashSpace::Query query(k);
-        int results = query(space, agents[i].pos() * space.dim(),
-                          space.maxRadius() * localRadius);
-        for (int j = 0; j < results; j++) { // these are the nearby boids
-          int id = query[j]->id;
-          if (agents[id].isDead) { continue; }
-          if (agents[id].canReproduce == false) { continue; } 
-          //only reproduce if the nearest neighbor is alive AND can also reproduce
-          //cout << "both agents can reproduce... will they make spawn???" << endl;
-          float distance = Vec3f(  agents[id].pos() - agents[i].pos()  ).mag(); //check their distance
-          if (distance < reproductionDistanceThreshold) { //if they are close enough, reproduce
-          //cout << tempNewAgents.size() << endl;
-            if (tempNewAgents.size() < MAX_AGENT_NUM - aliveAgents) {
-              Vec3f p = Vec3f(  (agents[i].pos() + agents[j].pos()) / 2  );
-              Vec3f o = Vec3f(  (agents[i].uf() + agents[j].uf()) / 2  );
-              //Vec3f h = Vec3f(  agents[i].heading + agents[j].heading  ) / 2;
-              //Vec3f c = Vec3f(  agents[i].center + agents[j].center  ) / 2;
-              Vec3f m = Vec3f(  (agents[i].moveRate + agents[j].moveRate) / 2  );
-              Vec3f t = Vec3f(  (agents[i].turnRate + agents[j].turnRate) / 2  );
-              Color col = (  agents[i].agentColor + agents[j].agentColor  ) / 2;
-              Vec3f c = Vec3f(col.r, col.g, col.b);
-              float cF = ( agents[i].chirp.centerFrequency + agents[j].chirp.centerFrequency ) / 2;
-              float r = ( agents[i].chirp.range + agents[j].chirp.range ) / 2;
-              float d = ( agents[i].chirp.duration + agents[j].chirp.duration ) / 2;
-              int nF = int(( agents[i].faceCount + agents[j].faceCount ) / 2);
-              float s = ( agents[i].spikiness + agents[j].spikiness ) / 2;
-              bool direction = false;
-              if (agents[i].chirp.up != agents[j].chirp.up) {
-                float rand = rnd::uniformS();
-                if (rand > 0) { direction = true; } else { direction = false; }
-              } else { direction = agents[i].chirp.up; }
-              //float iF = ( agents[i].impulse.getFrequency() + agents[j].impulse.getFrequency() ) / 2;
-
-              Agent a(p, o, m, t, c, cF ,r, d, direction, nF, s);
-              a.chirp.setWindowPtr(hanningWindow);
-              tempNewAgents.push_back(a);
-              //cout << "agent created! " << endl;
-            }
-          }
-        }
-      }
-      agents[i].canReproduce = false;     //reset reproduction boolean
-    }
-    //cout << "baby number: " << tempNewAgents.size() << endl;
-  }
-
-  void assignFitness() { //assign a fitness value to each agent based on specific rules
-    for (int i = 0; i < MAX_AGENT_NUM; i++) {
-      if (agents[i].isDead) { continue; }
-      //first, what is it's fitness value??
-      float valueScalar = 1.0f;
-      //cout << agents[i].fitnessValue << endl;
-      if (agents[i].fitnessValue > 500) {
-        valueScalar *= 10;
-      }
-
-      float value = 0.0;
-      //cout << "agent flockcount" << agents[i].flockCount << endl;
-      //flock count
-      if (agents[i].flockCount < 5 || agents[i].flockCount > 30) {
-        value -= rnd::uniform() * agents[i].flockCount;
-      } else {
-        value += rnd::uniform() * agents[i].flockCount; //some random relationship, but also proportional to flockCount
-      }
-      //move rate
-      if (agents[i].moveRate.mag() < 0.3 || agents[i].moveRate.mag() > 0.9) {
-        value -= rnd::uniform() * agents[i].moveRate.mag(); //some random relationship, but also dependent on magnitude of moveRate
-      } else {
-        value += rnd::uniform() * agents[i].moveRate.mag();
-      }
-      //turn rate
-      if (agents[i].turnRate.mag() < 0.3 || agents[i].turnRate.mag() > 0.9) {
-        value -= rnd::uniform() * agents[i].turnRate.mag();
-      } else {
-        value += rnd::uniform() * agents[i].turnRate.mag();
-      }
-
-      value *= valueScalar;
-      
-      agents[i].incrementFitness(value); //change agent's fitness value
-      agents[i].evaluateFitness(FITNESS_CUTOFF);
-    }
-  }
-
-  //check if the agent is dead -> DO THIS FOR ALL AGENTS
-  void checkAgentDeath() {
-    int agentCounter = 0;
-    int tempIndex = 0;
-    for (int i = 0; i < MAX_AGENT_NUM; i++) {
-      //cout << agents[i].cyclesBeforeAteFood << endl;
-      if ( ( agents[i].lifespan <= 0 || ( agents[i].cyclesBeforeAteFood >= 600 ) ) && agents[i].isChirping == false ) { 
-        //if their lifespan is 0 or they haven't eaten food in 10 seconds AND they aren't in the middle of making sound, kill
-        if (tempNewAgents.size() > 0 && i <= tempNewAgents.size()) { 
-          agents[i] = tempNewAgents[tempIndex]; //new agents are added from this vector in order of them being "born"
-          tempNewAgents.erase(tempNewAgents.begin() + tempIndex); // remove the one that was just added from the temp vector
-          agentCounter++;
-          //cout << "a baby was added!" << endl;
-        } 
-        else { agents[i].setDeathState(); }
-      } else { agentCounter++; }
-    }
-
-    aliveAgents = agentCounter;
-  }
-
-  void cull() { // random culling from the environment
-    if (counter % (int)timing == 0) { //if it is time to cull based on timing value, then apply the culling
-      //cout << "cull" << endl;
-      Vec3f cullPosition = Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS()); //pick a random position to cull
-      float radius = rnd::uniform() * 100.0; // pick a random radius
-
-      //add a cull to the mesh -> this is only if we want to visualize this culling
-      cullMesh.reset();
-      cullMesh.vertex(cullPosition);
-      cullMesh.color(Color(rnd::uniform(), rnd::uniform(), rnd::uniform(), 0.3));
-      cullMesh.texCoord(radius, 0);
-
-      // check if the agent is in the cull position -> if it is, kill it
-      for (int i = 0; i < MAX_AGENT_NUM; i++) {
-        if (agents[i].isDead) { continue; }
-        agents[i].randomCull(cullPosition, radius);
-      }
-
-      timing = rnd::uniform(1,1000); //reset timing
-    }
-  }
-
-  //flocking
-  void calcFlocking() { // calculate the average heading, center, and flockCount for each agent
-    for (unsigned i = 0; i < MAX_AGENT_NUM; i++) {
-      if (agents[i].isDead) { continue; }
-      agents[i].incrementLifespan(-1 * decreaseLifespanAmount); //every loop iteration, decrease the lifespan a bit
-      Vec3f avgHeading(0, 0, 0);
-      Vec3f centerPos(0, 0, 0);
-      agents[i].flockCount = 0; //reset flock count
-
-      HashSpace::Query query(k);
-      int results = query(space, agents[i].pos() * space.dim(),
-                          space.maxRadius() * localRadius);
-      for (int j = 0; j < results; j++) {
-        int id = query[j]->id;
-        if (agents[id].isDead) { continue; } // only look at the neighbors that are alive!
-        avgHeading += agents[id].uf() + agents[id].randomFlocking;
-        centerPos += agents[id].pos();
-      }
-      if (results > 0) {
-        avgHeading = avgHeading.normalize() / results;
-        centerPos = centerPos.normalize() / results;
-      }
-      agents[i].flockCount = results;
-      agents[i].heading = avgHeading;
-      agents[i].center = centerPos;
-    }
-  }
-
-  void alignmentAndCohesion() { //agent update function
-    //alignment and cohesion from boids algorithm
-    for (unsigned i = 0; i < MAX_AGENT_NUM; i++) {
-      if (agents[i].isDead) { continue; }
-      agents[i].pos().lerp(agents[i].center.normalize() + agents[i].uf(), agents[i].moveRate.mag() * rate);
-      space.move(i, agents[i].pos() * space.dim());
-      agents[i].faceToward( (agents[i].heading + agents[i].center + agents[i].uf()).normalize() * agents[i].turnRate.mag() ); // point agents in the direction of their heading
-    }
-  }
-
-  //set the states for rendering
-  void setState() {
+  //copy the simulation into a frame for the render thread (on the simulation thread)
+  void fillFrame(SimulationFrame& frame) {
+    TRACE_SCOPE("fillFrame");
     //copy simulation agents into drawable agents for rendering
-    //cout << agents.size() << endl;
-    for (unsigned i = 0; i < MAX_AGENT_NUM; i++) { // set state for all the agents, no matter if they are dead or not
-      DrawableAgent a(agents[i].pos(), agents[i].uf(), agents[i].uu(), agents[i].agentColor, agents[i].faceCount, agents[i].spikiness);
-      state().dAgents[i] = a;
+    AgentStore& agents = simulation.agents;
+    Field& field = simulation.field;
+    int agentCount = min((int)agents.alive.size(), MAX_AGENT_NUM); // the shared state can only carry so many
+    for (int k = 0; k < agentCount; k++) { // only the live agents are sent, packed at the front
+      int i = agents.alive[k];
+      DrawableAgent a(agents.position(i), agents.forward(i), agents.up(i), agents.color(i), agents.voice(i).faceCount, agents.voice(i).spikiness);
+      frame.dAgents[k] = a;
     }
+    frame.agentCount = agentCount;
 
     //set the environment
-    //cout << field.food.size() << endl;
-    for (unsigned i = 0; i < field.getAmountOfFood(); i++) {
+    int foodCount = min(field.getAmountOfFood(), MAX_FOOD_NUM);
+    for (int i = 0; i < foodCount; i++) {
       //copy all the new food positions
-      //cout << field.food[i].getPosition() << " ";
       DrawableFood f(field.food[i].getPosition(), field.food[i].getSize(), field.food[i].getColor());
-      state().dFood[i] = f;
+      frame.dFood[i] = f;
     }
+    frame.foodCount = foodCount;
+
+    frame.aliveAgents = simulation.aliveAgents;
+    frame.culled = simulation.culled;
+    frame.cullPosition = simulation.cullPosition;
+    frame.cullRadius = simulation.cullRadius;
+    frame.cullColor = simulation.cullColor;
+  }
+
+  //set the states for rendering from the newest finished frame
+  void setState(const SimulationFrame& frame) {
+    TRACE_SCOPE("setState");
+    copy(frame.dAgents, frame.dAgents + frame.agentCount, state().dAgents);
+    state().agentCount = frame.agentCount;
+    copy(frame.dFood, frame.dFood + frame.foodCount, state().dFood);
+    state().foodCount = frame.foodCount;
 
     //set the other state vars
     state().cameraPose.set(nav());
@@ -402,10 +239,41 @@ class MyApp : public DistributedAppWithState<SharedState>  {
     state().ratio = ratio.get();
   }
 
+  //the simulation thread: wait for onAnimate to ask for a step, simulate it, hand it over, repeat
+  void simulate() {
+    TRACE_THREAD_NAME("simulation");
+    while (true) {
+      double dt;
+      bool resetFirst;
+      {
+        unique_lock<mutex> guard(stepLock);
+        stepWanted.wait(guard, [&]() { return quitSimulation || stepsWanted > 0 || resetWanted; });
+        if (quitSimulation) { return; }
+        stepsWanted = 0; // steps asked for while the last one ran are dropped -> a slow simulation slows down instead of falling behind
+        dt = stepDt;
+        simulation.params = stepParams;
+        resetFirst = resetWanted;
+        resetWanted = false;
+      }
+      if (resetFirst) { simulation.reset(); }
+      simulation.step(dt); //update the food, the agents and the field
+      fillFrame(frames.writeBuffer());
+      frames.publish();
+    }
+  }
+
+  void stopSimulation() {
+    if (!simulationThread.joinable()) { return; }
+    { lock_guard<mutex> guard(stepLock); quitSimulation = true; }
+    stepWanted.notify_one();
+    simulationThread.join();
+  }
+
   //visualize everything (update the meshes)
   void visualizeAgents() { // visualize the agents, update meshes using DrawableAgent in state (for ALL screens)
+    TRACE_SCOPE("visualizeAgents");
     agentMesh.reset();
-    for (unsigned i = 0; i < MAX_AGENT_NUM; i++) {
+    for (int i = 0; i < state().agentCount; i++) {
       agentMesh.vertex(state().dAgents[i].position);
       agentMesh.normal(state().dAgents[i].forward);
       agentMesh.color(state().dAgents[i].agentColor.r, state().dAgents[i].agentColor.b, state().dAgents[i].agentColor.g, state().dAgents[i].agentColor.a);
@@ -414,9 +282,9 @@ class MyApp : public DistributedAppWithState<SharedState>  {
   }
 
   void visualizeFood() { // visualize the food, update meshes using DrawableFood in state (for ALL screens)
+    TRACE_SCOPE("visualizeFood");
     foodMesh.reset();
-    for (unsigned i = 0; i < field.getAmountOfFood(); i++) {
-      //cout << state().dFood[i].size << endl;
+    for (int i = 0; i < state().foodCount; i++) {
       foodMesh.vertex(state().dFood[i].position);
       foodMesh.color(state().dFood[i].color.r, state().dFood[i].color.g, state().dFood[i].color.b);
       foodMesh.texCoord(state().dFood[i].size, 0);
@@ -430,7 +298,7 @@ class MyApp : public DistributedAppWithState<SharedState>  {
   float timer{0};
 
   void onAnimate(double dt) override {
-    counter++;
+    TRACE_SCOPE("onAnimate");
     timer += dt;
     frameCount++;
     if (timer > 1) {
@@ -441,29 +309,23 @@ class MyApp : public DistributedAppWithState<SharedState>  {
   
     if (freeze == false) {
       if (cuttleboneDomain->isSender()) {
-        //update the food
-        respawnFood();
-
-        //update agents
-        calcFlocking();
-        alignmentAndCohesion();
-
-        assignFitness();
-        reproduce();
-
-        checkAgentDeath();
-        eatFood();
-
-        cull();
-
-        //update field
-        field.moveFood(); //move the food
-        field.updateFood(); //check what food was eaten and update the vector accordingly
+        //ask for the next step -> it is simulated while this frame is drawn
+        {
+          lock_guard<mutex> guard(stepLock);
+          syncParams(stepParams);
+          stepDt = dt;
+          stepsWanted++;
+        }
+        stepWanted.notify_one();
 
-        applyForces();
+        //draw the newest step the simulation thread finished, if it finished one since the last frame
+        if (!frames.update()) { return; } // still simulating -> keep the meshes (and state) of the last step
+        const SimulationFrame& frame = frames.readBuffer();
+        aliveAgents = frame.aliveAgents;
+        if (frame.culled) { updateCullMesh(frame); }
 
         //state
-        setState();
+        setState(frame);
       } else {  nav().set(state().cameraPose);  }
 
       visualizeAgents();
@@ -474,20 +336,9 @@ class MyApp : public DistributedAppWithState<SharedState>  {
   //***********************************************************************
   // key pressed
 
-  void reset() { //reset agents
-    //clear the baby vector
-    tempNewAgents.clear();
-    tempNewAgents.resize(0);
-    //push completely new agents
-    for (int i = 0; i < MAX_AGENT_NUM; i++) {
-      Agent a;
-      agents[i] = a;
-      agents[i].chirp.setWindowPtr(hanningWindow);
-    }
-
-    foodMesh.reset();
-    field.resetField();
-    initFoodMesh();
+  void reset() { //reset agents and the field -> on the simulation thread, before its next step
+    { lock_guard<mutex> guard(stepLock); resetWanted = true; }
+    stepWanted.notify_one();
   }
 
   bool onKeyDown(const Keyboard& k) override {
@@ -497,6 +348,10 @@ class MyApp : public DistributedAppWithState<SharedState>  {
     if (k.key() == ' ') {
       freeze = !freeze;
     }
+    if (k.key() == 't') { // dump the tracing zones
+      if (Tracer::instance().writeChromeTrace("trace.json")) { cout << "wrote trace.json" << endl; }
+      else { cerr << "could not write trace.json" << endl; }
+    }
     return true;
   }
 
@@ -504,15 +359,17 @@ class MyApp : public DistributedAppWithState<SharedState>  {
   // onSound
 
   void onSound(AudioIOData& io) override {
+    TRACE_THREAD_NAME("audio");
+    TRACE_SCOPE("onSound");
     float currentSample;
     while (io()) {
       currentSample = 0.0;
-      for (int i = 0; i < MAX_AGENT_NUM; i++) {
-        if (!agents[i].isDead) {
-          currentSample += agents[i].nextSample(); // get samples from all of the agents
+      simulation.agents.forEachVoice([&](AgentVoice& voice) { // the voices of all of the agents
+        if (voice.active) {
+          currentSample += voice.nextSample(); // get samples from all of the agents
         }
-      }
-      currentSample /= MAX_AGENT_NUM;
+      });
+      currentSample /= simulation.agents.capacity;
       io.out(0) = io.out(1) = currentSample;    // write the signal to channels 0 and 1
     }
   }
@@ -521,6 +378,7 @@ class MyApp : public DistributedAppWithState<SharedState>  {
   // draw loop
 
   void renderAgents(Graphics& g) {
+    TRACE_SCOPE("renderAgents");
     //agent shader
     g.shader(agentShader);
     g.shader().uniform("size", state().size * 0.03);
@@ -530,6 +388,7 @@ class MyApp : public DistributedAppWithState<SharedState>  {
   }
 
   void renderFood(Graphics& g) {
+    TRACE_SCOPE("renderFood");
     //food shader
     g.shader(foodShader);
     g.shader().uniform("pointSize", state().size * 0.005);
@@ -538,7 +397,10 @@ class MyApp : public DistributedAppWithState<SharedState>  {
     //g.draw(cullMesh);
   }
 
+  void onExit() override { stopSimulation(); }
+
   void onDraw(Graphics& g) override {
+    TRACE_SCOPE("onDraw");
     g.clear(state().background, state().background, state().background);
     gl::depthTesting(true);  // or g.depthTesting(true);
     gl::blending(true);      // or g.blending(true);
@@ -551,13 +413,26 @@ class MyApp : public DistributedAppWithState<SharedState>  {
       gui.draw(g);
     }
   }
+
+ public:
+  MyApp(const SimulationConfig& config) : simulation(config) {}
+  ~MyApp() { stopSimulation(); }
 };
 
 //***********************************************************************
 // main
 
-int main() {
-  MyApp app;
+int main(int argc, char* argv[]) {
+  SimulationConfig config;
+  bool ok = true;
+  for (int i = 1; i < argc; i++) {
+    if (!config.parseArg(argc, argv, i, ok)) { ok = false; }
+  }
+  if (!ok || !config.valid()) {
+    std::cerr << "usage: " << argv[0] << " " << SimulationConfig::usage() << std::endl;
+    return 1;
+  }
+  MyApp app(config);
   app.configureAudio(44100, 2048, 2, 0); // Enable audio with 2 channels of output.
   app.start();
 }
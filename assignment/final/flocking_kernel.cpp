@@ -0,0 +1,253 @@
+/* flocking_kernel.cpp
+ * This file describes FlockingKernel, the flocking math on 8 agents at a time:
+ *   flock() -> every agent's heading and center, summed over its neighbors and normalized (calcFlocking)
+ *   move()  -> every agent moved toward its center and turned toward its heading (alignmentAndCohesion)
+ * The neighbors of 8 agents sit side by side in a padded table (lane l of row j: the j-th neighbor of the block's agent l,
+ * -1 if it has fewer or that neighbor is dead), so all 8 lanes run the same loop, with no branches
+ * Lanes is 8 floats: AVX2 registers (build with -mavx2 or -march=native), two NEON registers on arm64, plain arrays elsewhere
+ * Normalizing uses the fast reciprocal square root (plus Newton steps), so the results are within ~1e-6 of the scalar code in
+ * simulation.cpp, not bit-identical -> that scalar code stays as the reference (flockingKernel scalar), and flockingKernel validate
+ * runs both every step and keeps the largest difference
+ * The kernel only writes its own arrays (indexed like agents.alive), the simulation copies them into the AgentStore
+ */
+
+#pragma once
+
+//c std library includes
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+//my includes
+#include "agent_store.cpp"
+#include "../common/parallel.cpp"
+#include "spatial_grid.cpp"
+
+using namespace std;
+
+// true when Lanes are real vector registers -> only then is the kernel the simulation's default (SimulationConfig::flockingKernel),
+// the plain-array Lanes are there so the kernel builds and validates everywhere, not to be fast
+#if defined(__AVX2__) || (defined(__ARM_NEON) && defined(__aarch64__))
+const bool FLOCKING_KERNEL_VECTORIZED = true;
+#else
+const bool FLOCKING_KERNEL_VECTORIZED = false;
+#endif
+
+// 8 floats, and a mask of 8 lanes
+#if defined(__AVX2__)
+struct Lanes {
+  __m256 v;
+  Lanes() {}
+  Lanes(__m256 a) : v(a) {}
+  Lanes(float a) : v(_mm256_set1_ps(a)) {}
+  static Lanes load(const float* p) { return _mm256_loadu_ps(p); }
+  void store(float* p) const { _mm256_storeu_ps(p, v); }
+  static Lanes gather(const float* base, const int* ids) { // base[ids[l]], 0 where ids[l] < 0
+    __m256i index = _mm256_loadu_si256((const __m256i*)ids);
+    __m256i valid = _mm256_cmpgt_epi32(index, _mm256_set1_epi32(-1));
+    return _mm256_mask_i32gather_ps(_mm256_setzero_ps(), base, _mm256_and_si256(index, valid), _mm256_castsi256_ps(valid), 4);
+  }
+  friend Lanes operator+(Lanes a, Lanes b) { return _mm256_add_ps(a.v, b.v); }
+  friend Lanes operator-(Lanes a, Lanes b) { return _mm256_sub_ps(a.v, b.v); }
+  friend Lanes operator*(Lanes a, Lanes b) { return _mm256_mul_ps(a.v, b.v); }
+  friend Lanes operator/(Lanes a, Lanes b) { return _mm256_div_ps(a.v, b.v); }
+  friend Lanes sqrt(Lanes a) { return _mm256_sqrt_ps(a.v); }
+  friend Lanes rsqrt(Lanes a) { // ~12 bit estimate, one Newton step -> ~23 bits
+    __m256 y = _mm256_rsqrt_ps(a.v);
+    return _mm256_mul_ps(y, _mm256_sub_ps(_mm256_set1_ps(1.5f), _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), a.v), _mm256_mul_ps(y, y))));
+  }
+  // masks are lanes of all ones or all zeros
+  friend Lanes operator>(Lanes a, Lanes b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+  friend Lanes operator<(Lanes a, Lanes b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+  friend Lanes select(Lanes mask, Lanes a, Lanes b) { return _mm256_blendv_ps(b.v, a.v, mask.v); } // mask ? a : b
+};
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+struct Lanes {
+  float32x4_t lo, hi;
+  Lanes() {}
+  Lanes(float32x4_t a, float32x4_t b) : lo(a), hi(b) {}
+  Lanes(float a) : lo(vdupq_n_f32(a)), hi(vdupq_n_f32(a)) {}
+  static Lanes load(const float* p) { return Lanes(vld1q_f32(p), vld1q_f32(p + 4)); }
+  void store(float* p) const { vst1q_f32(p, lo); vst1q_f32(p + 4, hi); }
+  static Lanes gather(const float* base, const int* ids) { // no gather instruction, the lanes are loaded one by one
+    float values[8];
+    for (int l = 0; l < 8; l++) { values[l] = ids[l] >= 0 ? base[ids[l]] : 0.0f; }
+    return load(values);
+  }
+  friend Lanes operator+(Lanes a, Lanes b) { return Lanes(vaddq_f32(a.lo, b.lo), vaddq_f32(a.hi, b.hi)); }
+  friend Lanes operator-(Lanes a, Lanes b) { return Lanes(vsubq_f32(a.lo, b.lo), vsubq_f32(a.hi, b.hi)); }
+  friend Lanes operator*(Lanes a, Lanes b) { return Lanes(vmulq_f32(a.lo, b.lo), vmulq_f32(a.hi, b.hi)); }
+  friend Lanes operator/(Lanes a, Lanes b) { return Lanes(vdivq_f32(a.lo, b.lo), vdivq_f32(a.hi, b.hi)); }
+  friend Lanes sqrt(Lanes a) { return Lanes(vsqrtq_f32(a.lo), vsqrtq_f32(a.hi)); }
+  static float32x4_t rsqrt4(float32x4_t a) { // ~8 bit estimate, two Newton steps -> ~23 bits
+    float32x4_t y = vrsqrteq_f32(a);
+    y = vmulq_f32(y, vrsqrtsq_f32(vmulq_f32(a, y), y));
+    return vmulq_f32(y, vrsqrtsq_f32(vmulq_f32(a, y), y));
+  }
+  friend Lanes rsqrt(Lanes a) { return Lanes(rsqrt4(a.lo), rsqrt4(a.hi)); }
+  friend Lanes operator>(Lanes a, Lanes b) {
+    return Lanes(vreinterpretq_f32_u32(vcgtq_f32(a.lo, b.lo)), vreinterpretq_f32_u32(vcgtq_f32(a.hi, b.hi)));
+  }
+  friend Lanes operator<(Lanes a, Lanes b) {
+    return Lanes(vreinterpretq_f32_u32(vcltq_f32(a.lo, b.lo)), vreinterpretq_f32_u32(vcltq_f32(a.hi, b.hi)));
+  }
+  friend Lanes select(Lanes mask, Lanes a, Lanes b) {
+    return Lanes(vbslq_f32(vreinterpretq_u32_f32(mask.lo), a.lo, b.lo), vbslq_f32(vreinterpretq_u32_f32(mask.hi), a.hi, b.hi));
+  }
+};
+#else
+struct Lanes { // no vector unit we know of -> plain loops, which the compiler can still vectorize (SSE on x86)
+  float v[8];
+  Lanes() {}
+  Lanes(float a) { for (int l = 0; l < 8; l++) { v[l] = a; } }
+  static Lanes load(const float* p) { Lanes r; for (int l = 0; l < 8; l++) { r.v[l] = p[l]; } return r; }
+  void store(float* p) const { for (int l = 0; l < 8; l++) { p[l] = v[l]; } }
+  static Lanes gather(const float* base, const int* ids) {
+    Lanes r;
+    for (int l = 0; l < 8; l++) { r.v[l] = ids[l] >= 0 ? base[ids[l]] : 0.0f; }
+    return r;
+  }
+  template <class F>
+  static Lanes each(F f) { Lanes r; for (int l = 0; l < 8; l++) { r.v[l] = f(l); } return r; }
+  friend Lanes operator+(Lanes a, Lanes b) { return each([&](int l) { return a.v[l] + b.v[l]; }); }
+  friend Lanes operator-(Lanes a, Lanes b) { return each([&](int l) { return a.v[l] - b.v[l]; }); }
+  friend Lanes operator*(Lanes a, Lanes b) { return each([&](int l) { return a.v[l] * b.v[l]; }); }
+  friend Lanes operator/(Lanes a, Lanes b) { return each([&](int l) { return a.v[l] / b.v[l]; }); }
+  friend Lanes sqrt(Lanes a) { return each([&](int l) { return std::sqrt(a.v[l]); }); }
+  friend Lanes rsqrt(Lanes a) { return each([&](int l) { return 1.0f / std::sqrt(a.v[l]); }); }
+  friend Lanes operator>(Lanes a, Lanes b) { return each([&](int l) { return a.v[l] > b.v[l] ? 1.0f : 0.0f; }); }
+  friend Lanes operator<(Lanes a, Lanes b) { return each([&](int l) { return a.v[l] < b.v[l] ? 1.0f : 0.0f; }); }
+  friend Lanes select(Lanes mask, Lanes a, Lanes b) { return each([&](int l) { return mask.v[l] != 0 ? a.v[l] : b.v[l]; }); }
+};
+#endif
+
+// three Lanes -> 8 vectors
+struct Lanes3 {
+  Lanes x, y, z;
+  Lanes3() {}
+  Lanes3(Lanes a, Lanes b, Lanes c) : x(a), y(b), z(c) {}
+  static Lanes3 gather(const float* bx, const float* by, const float* bz, const int* ids) {
+    return Lanes3(Lanes::gather(bx, ids), Lanes::gather(by, ids), Lanes::gather(bz, ids));
+  }
+  void store(float* px, float* py, float* pz) const { x.store(px); y.store(py); z.store(pz); }
+  friend Lanes3 operator+(Lanes3 a, Lanes3 b) { return Lanes3(a.x + b.x, a.y + b.y, a.z + b.z); }
+  friend Lanes3 operator-(Lanes3 a, Lanes3 b) { return Lanes3(a.x - b.x, a.y - b.y, a.z - b.z); }
+  friend Lanes3 operator*(Lanes3 a, Lanes s) { return Lanes3(a.x * s, a.y * s, a.z * s); }
+  friend Lanes dot(Lanes3 a, Lanes3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+  friend Lanes3 cross(Lanes3 a, Lanes3 b) { return Lanes3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x); }
+  friend Lanes mag(Lanes3 a) { return sqrt(dot(a, a)); }
+  friend Lanes3 select(Lanes mask, Lanes3 a, Lanes3 b) { return Lanes3(select(mask, a.x, b.x), select(mask, a.y, b.y), select(mask, a.z, b.z)); }
+  friend Lanes3 normalize(Lanes3 a) { // like Vec3f::normalize: a zero vector becomes (1, 0, 0)
+    Lanes m2 = dot(a, a);
+    Lanes nonzero = m2 > Lanes(0.0f);
+    return select(nonzero, a * rsqrt(m2), Lanes3(1.0f, 0.0f, 0.0f));
+  }
+};
+
+struct FlockingKernel {
+  static const int LANES = 8;
+  int blocks = 0; // alive.size() / 8, rounded up
+  vector<int> agentIds; // the block's agents (agents.alive, padded with -1 to whole blocks)
+  //the results, indexed like agents.alive
+  vector<float> hx, hy, hz; // flock()
+  vector<float> cx, cy, cz; // flock() and move()
+  vector<float> px, py, pz, fx, fy, fz, ux, uy, uz; // move()
+
+  void resize(const vector<int>& alive) {
+    blocks = (alive.size() + LANES - 1) / LANES;
+    int n = blocks * LANES;
+    agentIds.assign(alive.begin(), alive.end());
+    agentIds.resize(n, -1);
+    for (vector<float>* out : {&hx, &hy, &hz, &cx, &cy, &cz, &px, &py, &pz, &fx, &fy, &fz, &ux, &uy, &uz}) { out->resize(n); }
+  }
+
+  // heading = normalize(sum of the neighbors' forward + randomFlocking) / count, center = normalize(sum of their positions) / count
+  // each block first pads its agents' neighbor lists to the longest one in the block (-1 = no neighbor, or a dead one)
+  // eachBlock(b) runs right after block b is done, on the same thread (its results are still in cache there)
+  void flock(const AgentStore& agents, const NeighborTable& neighbors) { flock(agents, neighbors, [](int) {}); }
+  template <class EachBlock>
+  void flock(const AgentStore& agents, const NeighborTable& neighbors, EachBlock eachBlock) {
+    resize(agents.alive);
+    parallelFor(blocks, 128, [&](int begin, int end) {
+      vector<int> table; // row j, lane l -> table[j * 8 + l], kept across the blocks of this chunk
+      for (int b = begin; b < end; b++) {
+        int count[LANES], rows = 0;
+        float inverseCount[LANES]; // 1 / the neighbor count (dead ones included, like calcFlocking), 0 without neighbors
+        for (int l = 0; l < LANES; l++) {
+          int i = agentIds[b * LANES + l];
+          count[l] = i >= 0 ? neighbors.count(i) : 0;
+          inverseCount[l] = count[l] > 0 ? 1.0f / count[l] : 0.0f;
+          rows = max(rows, count[l]);
+        }
+        if (table.size() < (size_t)rows * LANES) { table.resize(rows * LANES); }
+        for (int l = 0; l < LANES; l++) {
+          int i = agentIds[b * LANES + l];
+          for (int j = 0; j < rows; j++) {
+            int id = j < count[l] ? neighbors.neighbor(i, j) : -1;
+            if (id >= 0 && agents.isDead[id]) { id = -1; } // only look at the neighbors that are alive!
+            table[j * LANES + l] = id;
+          }
+        }
+
+        Lanes3 heading(0.0f, 0.0f, 0.0f), center(0.0f, 0.0f, 0.0f);
+        for (int j = 0; j < rows; j++) {
+          const int* ids = &table[j * LANES];
+          heading = heading + Lanes3::gather(agents.fx.data(), agents.fy.data(), agents.fz.data(), ids)
+                            + Lanes3::gather(agents.rx.data(), agents.ry.data(), agents.rz.data(), ids);
+          center = center + Lanes3::gather(agents.px.data(), agents.py.data(), agents.pz.data(), ids);
+        }
+        Lanes scale = Lanes::load(inverseCount); // 0 without neighbors -> the sums stay 0, like calcFlocking
+        int o = b * LANES;
+        (normalize(heading) * scale).store(&hx[o], &hy[o], &hz[o]);
+        (normalize(center) * scale).store(&cx[o], &cy[o], &cz[o]);
+        eachBlock(b);
+      }
+    });
+  }
+
+  // center normalized, position lerped toward center + forward by |moveRate| * rate,
+  // then turned to face normalize(heading + center + forward) * |turnRate| (AgentStore::faceToward)
+  // (every agent only reads its own attributes here, so eachBlock(b) may write block b's results back into the store)
+  void move(const AgentStore& agents, float rate) { move(agents, rate, [](int) {}); }
+  template <class EachBlock>
+  void move(const AgentStore& agents, float rate, EachBlock eachBlock) {
+    resize(agents.alive);
+    parallelFor(blocks, 128, [&](int begin, int end) {
+      for (int b = begin; b < end; b++) {
+        const int* ids = &agentIds[b * LANES];
+        Lanes3 position = Lanes3::gather(agents.px.data(), agents.py.data(), agents.pz.data(), ids);
+        Lanes3 forward = Lanes3::gather(agents.fx.data(), agents.fy.data(), agents.fz.data(), ids);
+        Lanes3 up = Lanes3::gather(agents.ux.data(), agents.uy.data(), agents.uz.data(), ids);
+        Lanes3 heading = Lanes3::gather(agents.hx.data(), agents.hy.data(), agents.hz.data(), ids);
+        Lanes3 center = normalize(Lanes3::gather(agents.cx.data(), agents.cy.data(), agents.cz.data(), ids));
+        Lanes moveRate = mag(Lanes3::gather(agents.mx.data(), agents.my.data(), agents.mz.data(), ids));
+        Lanes turnRate = mag(Lanes3::gather(agents.tx.data(), agents.ty.data(), agents.tz.data(), ids));
+
+        position = position + (center + forward - position) * (moveRate * Lanes(rate));
+        Lanes3 point = normalize(heading + center + forward) * turnRate;
+
+        //faceToward(point)
+        Lanes3 target = point - position;
+        Lanes length2 = dot(target, target);
+        Lanes turns = Lanes(1e-24f) < length2; // closer than 1e-12 -> it keeps facing where it faced
+        target = target * rsqrt(length2);
+        Lanes c = dot(forward, target); // cosine of the rotation angle
+        Lanes3 v = cross(forward, target);
+        Lanes3 rotated = up * c + cross(v, up) + v * (dot(v, up) / (Lanes(1.0f) + c)); // Rodrigues
+        Lanes3 newUp = select(c > Lanes(-0.9999f), rotated, up); // else: forward flips, up stays
+        newUp = normalize(newUp - target * dot(newUp, target));
+
+        int o = b * LANES;
+        position.store(&px[o], &py[o], &pz[o]);
+        center.store(&cx[o], &cy[o], &cz[o]);
+        select(turns, target, forward).store(&fx[o], &fy[o], &fz[o]);
+        select(turns, newUp, up).store(&ux[o], &uy[o], &uz[o]);
+        eachBlock(b);
+      }
+    });
+  }
+};
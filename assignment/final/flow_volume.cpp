@@ -0,0 +1,247 @@
+/* flow_volume.cpp
+ * This file describes FlowVolume, precomputed flow (CFD output, curl noise bakes...) the agents can follow instead of the fluid solver
+ * A volume file is a sequence of frames, every frame a 3D grid of velocity vectors:
+ *   a 64 byte header (VolumeHeader: "FLOWVOL1", nx ny nz frames, the box the grid covers, seconds between frames)
+ *   then every frame: nx*ny*nz x components, then the y components, then the z components, x fastest then y then z
+ *   everything little endian, 32 bit ints and floats (flowbake.cpp writes one from the fluid solver)
+ * The file is memory mapped, never read into memory as a whole -> volumes can be far bigger than RAM
+ * The agents sample two frames kept in memory and blend them in time; a loader thread copies the frame after them out of the
+ * mapping in the background (that is where the disk reads happen), so stepping to the next frame never waits on the disk
+ * If the loader falls behind, playback holds at the last frame it has instead of stalling; waitForFrames (seeded runs) waits instead
+ * The mapping uses mmap, so this only works on mac and linux
+ */
+
+#pragma once
+
+//c std library includes
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+//my includes
+#include "fluid.cpp"
+#include "../common/parallel.cpp"
+
+using namespace std;
+
+struct VolumeHeader {
+  char magic[8] = {'F', 'L', 'O', 'W', 'V', 'O', 'L', '1'};
+  int32_t nx = 0, ny = 0, nz = 0; // grid points along each axis (at least 2)
+  int32_t frames = 0;
+  float boxMin[3] = {-1, -1, -1}, boxMax[3] = {1, 1, 1}; // the grid points are spread over this box (max > min on every axis)
+  float frameSeconds = 1.0f / 30; // time between two frames
+  char reserved[12] = {}; // -> the frames start 64 bytes in
+};
+static_assert(sizeof(VolumeHeader) == 64, "the volume header is 64 bytes on disk");
+
+struct FlowVolume {
+  VolumeHeader header;
+  float playbackRate = 1; // 2 -> the flow plays twice as fast
+  float strength = 1; // the sampled velocity is scaled by this
+  bool loop = true; // after the last frame comes the first one, false -> hold the last frame
+  bool waitForFrames = false; // true -> wait for the loader instead of holding a frame (a seeded run must not depend on the disk)
+
+  const char* data = nullptr; // the mapped file
+  size_t bytes = 0;
+  static const int MAX_SIDE = 4096; // grid points along an axis, a bigger header is a broken file
+  size_t frameFloats = 0; // nx*ny*nz
+  double time = 0; // playback position, in frames
+
+  // three frames in memory: the two being blended (slot[0] -> slot[1]) and the one the loader is filling
+  vector<float> slots[3];
+  int frameOf[3] = {-1, -1, -1}; // the frame in every slot
+  int current = 0, next = 1, spare = 2;
+
+  thread loader;
+  mutex lock;
+  condition_variable wake, loaded;
+  int request = -1; // the frame the loader should copy into spare, -1 -> nothing to do
+  bool spareReady = false;
+  bool quit = false;
+
+  ~FlowVolume() { close(); }
+
+  bool isOpen() const { return data != nullptr; }
+  int frames() const { return header.frames; }
+
+  bool open(const string& path) { // map the volume file, false (and why on cerr) if it can't be used
+    close();
+#ifdef _WIN32
+    cerr << path << ": flow volumes need mmap (mac or linux)" << endl;
+    return false;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) { cerr << path << ": can't open it" << endl; return false; }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(VolumeHeader)) {
+      cerr << path << ": not a flow volume" << endl;
+      ::close(fd);
+      return false;
+    }
+    void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping keeps the file open
+    if (mapped == MAP_FAILED) { cerr << path << ": can't map it" << endl; return false; }
+    data = (const char*)mapped;
+    bytes = info.st_size;
+    memcpy(&header, data, sizeof(VolumeHeader));
+    if (memcmp(header.magic, "FLOWVOL1", 8) != 0 || header.nx < 2 || header.ny < 2 || header.nz < 2 || header.nx > MAX_SIDE
+        || header.ny > MAX_SIDE || header.nz > MAX_SIDE || header.frames < 1 || !(header.frameSeconds > 0)) {
+      cerr << path << ": not a flow volume" << endl;
+      close();
+      return false;
+    }
+    frameFloats = (size_t)header.nx * header.ny * header.nz; // at most 2^36 -> no overflow
+    if ((size_t)header.frames > (bytes - sizeof(VolumeHeader)) / frameBytes()) { // divided, frames * frameBytes() could wrap
+      cerr << path << ": the file is cut short (" << header.frames << " frames in the header)" << endl;
+      close();
+      return false;
+    }
+    for (int a = 0; a < 3; a++) { // an empty (or NaN) box would divide by zero in the world -> grid transform
+      if (!isfinite(header.boxMin[a]) || !isfinite(header.boxMax[a]) || !(header.boxMax[a] > header.boxMin[a])) {
+        cerr << path << ": the volume's box is empty along axis " << a << endl;
+        close();
+        return false;
+      }
+    }
+    madvise(mapped, bytes, MADV_SEQUENTIAL); // frames are read in order, the kernel can read ahead and drop what was played
+    for (vector<float>& slot : slots) { slot.resize(3 * frameFloats); }
+    quit = false;
+    loader = thread([this]() { loadFrames(); });
+    restart();
+    return true;
+#endif
+  }
+
+  void close() {
+    if (loader.joinable()) {
+      { lock_guard<mutex> guard(lock); quit = true; }
+      wake.notify_all();
+      loader.join();
+    }
+#ifndef _WIN32
+    if (data) { munmap((void*)data, bytes); }
+#endif
+    data = nullptr;
+    bytes = 0;
+  }
+
+  size_t frameBytes() const { return 3 * frameFloats * sizeof(float); }
+  const float* frameData(int f) const { return (const float*)(data + sizeof(VolumeHeader) + f * frameBytes()); }
+
+  int frameAfter(int f) const { return f + 1 < frames() ? f + 1 : (loop ? 0 : f); }
+
+  void restart() { // back to the first frame, the first two are copied right here
+    {
+      unique_lock<mutex> guard(lock);
+      loaded.wait(guard, [&]() { return request < 0; }); // the loader is not touching spare
+      spareReady = false;
+    }
+    time = 0;
+    frameOf[current] = 0;
+    frameOf[next] = frameAfter(0);
+    memcpy(slots[current].data(), frameData(frameOf[current]), frameBytes());
+    memcpy(slots[next].data(), frameData(frameOf[next]), frameBytes());
+    requestFrame(frameAfter(frameOf[next]));
+  }
+
+  void requestFrame(int f) { // have the loader copy f into spare
+    { lock_guard<mutex> guard(lock); request = f; spareReady = false; }
+    wake.notify_one();
+  }
+
+  void loadFrames() { // the loader thread
+    unique_lock<mutex> guard(lock);
+    while (true) {
+      wake.wait(guard, [&]() { return quit || request >= 0; });
+      if (quit) { return; }
+      int f = request, slot = spare;
+      guard.unlock();
+      memcpy(slots[slot].data(), frameData(f), frameBytes()); // the page faults (disk reads) happen here, not on the simulation thread
+#ifndef _WIN32
+      // and have the kernel start reading the frame after it
+      int after = frameAfter(f);
+      uintptr_t page = sysconf(_SC_PAGESIZE);
+      uintptr_t start = (uintptr_t)frameData(after) & ~(page - 1);
+      madvise((void*)start, frameBytes() + ((uintptr_t)frameData(after) - start), MADV_WILLNEED);
+#endif
+      guard.lock();
+      frameOf[slot] = f;
+      request = -1;
+      spareReady = true;
+      loaded.notify_all();
+    }
+  }
+
+  // move the playback on by dt seconds
+  void advance(float dt) {
+    if (!isOpen() || frames() == 1) { return; }
+    time += dt * playbackRate / header.frameSeconds;
+    while (time >= 1) { // past the next frame -> it becomes the current one, and the spare (the frame after it) the next
+      if (!loop && frameOf[next] == frames() - 1) { time = 1; return; } // the end, hold the last frame
+      unique_lock<mutex> guard(lock);
+      if (!spareReady) {
+        if (!waitForFrames) { time = 1; return; } // the loader is behind, hold here until it catches up
+        loaded.wait(guard, [&]() { return spareReady; });
+      }
+      int played = current;
+      current = next;
+      next = spare;
+      spare = played;
+      spareReady = false;
+      guard.unlock();
+      time -= 1;
+      requestFrame(frameAfter(frameOf[next]));
+    }
+  }
+
+  // the flow at the positions of ids (x[id], y[id], z[id]) -> out*[k] for ids[k], blended between the two frames in memory
+  void sample(const vector<int>& ids, const float* x, const float* y, const float* z,
+              float* outX, float* outY, float* outZ) const {
+    const VolumeHeader& h = header;
+    float scaleX = (h.nx - 1) / (h.boxMax[0] - h.boxMin[0]); // position -> grid coordinate
+    float scaleY = (h.ny - 1) / (h.boxMax[1] - h.boxMin[1]);
+    float scaleZ = (h.nz - 1) / (h.boxMax[2] - h.boxMin[2]);
+    float t = min(max((float)time, 0.0f), 1.0f);
+    const float* a = slots[current].data();
+    const float* b = slots[next].data();
+    size_t n = frameFloats;
+    parallelFor(ids.size(), 4096, [&](int begin, int end) {
+      for (int k = begin; k < end; k++) {
+        int id = ids[k];
+        float u = (x[id] - h.boxMin[0]) * scaleX, v = (y[id] - h.boxMin[1]) * scaleY, w = (z[id] - h.boxMin[2]) * scaleZ;
+        float ax = trilinear(a, h.nx, h.ny, h.nz, u, v, w), bx = trilinear(b, h.nx, h.ny, h.nz, u, v, w);
+        float ay = trilinear(a + n, h.nx, h.ny, h.nz, u, v, w), by = trilinear(b + n, h.nx, h.ny, h.nz, u, v, w);
+        float az = trilinear(a + 2 * n, h.nx, h.ny, h.nz, u, v, w), bz = trilinear(b + 2 * n, h.nx, h.ny, h.nz, u, v, w);
+        outX[k] = (ax + (bx - ax) * t) * strength;
+        outY[k] = (ay + (by - ay) * t) * strength;
+        outZ[k] = (az + (bz - az) * t) * strength;
+      }
+    });
+  }
+
+  // write a volume: the header, then call writeFrame (x, y and z planes of nx*ny*nz floats) header.frames times
+  static bool writeHeader(ofstream& file, const VolumeHeader& h) {
+    file.write((const char*)&h, sizeof(VolumeHeader));
+    return file.good();
+  }
+  static bool writeFrame(ofstream& file, const float* x, const float* y, const float* z, size_t n) {
+    file.write((const char*)x, n * sizeof(float));
+    file.write((const char*)y, n * sizeof(float));
+    file.write((const char*)z, n * sizeof(float));
+    return file.good();
+  }
+};
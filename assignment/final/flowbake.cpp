@@ -0,0 +1,68 @@
+/* flowbake.cpp
+ * Bakes the fluid solver (fluid.cpp) into a flow volume file (flow_volume.cpp), to try volumes out without CFD data
+ * Every frame is the fluid after one more solve, so the volume plays back the same currents the fluid would have made
+ *
+ * Usage: flowbake --out file [--side N] [--frames N] [--fps N] [--extent N] [--seed N]
+ *   --side    grid points along each axis (default 32)
+ *   --frames  how many frames to write (default 120)
+ *   --fps     frames per second of flow time (default 30)
+ *   --extent  the volume covers -extent..extent (default 1)
+ * Then: headless --flowVolume file (or final.cpp --flowVolume file)
+ */
+
+//c std library includes
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+//my includes
+#include "flow_volume.cpp"
+#include "fluid.cpp"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+  const char* out = nullptr;
+  int side = 32, frames = 120;
+  float fps = 30, extent = 1;
+  uint32_t seed = 1;
+  bool ok = true;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) { out = argv[++i]; }
+    else if (strcmp(argv[i], "--side") == 0 && i + 1 < argc) { side = atoi(argv[++i]); }
+    else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) { frames = atoi(argv[++i]); }
+    else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) { fps = atof(argv[++i]); }
+    else if (strcmp(argv[i], "--extent") == 0 && i + 1 < argc) { extent = atof(argv[++i]); }
+    else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) { seed = strtoul(argv[++i], nullptr, 10); }
+    else { ok = false; }
+  }
+  if (!ok || !out || side < 3 || frames < 1 || fps <= 0 || extent <= 0) {
+    cerr << "usage: flowbake --out file [--side N] [--frames N] [--fps N] [--extent N] [--seed N]" << endl;
+    return 1;
+  }
+
+  ofstream file(out, ios::binary);
+  VolumeHeader header;
+  header.nx = header.ny = header.nz = side;
+  header.frames = frames;
+  for (int a = 0; a < 3; a++) { header.boxMin[a] = -extent; header.boxMax[a] = extent; }
+  header.frameSeconds = 1 / fps;
+  if (!FlowVolume::writeHeader(file, header)) { cerr << out << ": can't write it" << endl; return 1; }
+
+  Fluid fluid;
+  fluid.extent = extent;
+  fluid.finishEveryStep = true;
+  rnd::Random<> rng;
+  rng.seed(seed);
+  fluid.make(side, rng);
+  size_t n = (size_t)side * side * side;
+  for (int f = 0; f < frames; f++) {
+    if (!FlowVolume::writeFrame(file, fluid.velX.data(), fluid.velY.data(), fluid.velZ.data(), n)) {
+      cerr << out << ": can't write it" << endl;
+      return 1;
+    }
+    fluid.step(header.frameSeconds, rng);
+  }
+  cout << "wrote " << frames << " frames of " << side << "^3 to " << out << endl;
+  return 0;
+}
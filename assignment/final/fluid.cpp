@@ -0,0 +1,308 @@
+/* fluid.cpp
+ * This file describes the flow field the agents ride -> an incompressible fluid on a side x side x side grid (stable fluids, Jos Stam 1999)
+ * The grid points are spread over -extent..extent, the points on the outside are the walls of the box
+ * A solve: random stirs push the fluid around, then it diffuses (viscosity), is carried along by itself (advection),
+ * and the pressure is solved so that no fluid piles up anywhere (projection) -> the currents stay smooth and swirly
+ * Every part of a solve is a pass over the z slices of the grid (the Jacobi stencils have the x loop innermost so they vectorize),
+ * step() works through the passes a few slices at a time (in parallel, parallel.cpp) and stops when it has used up budgetMs,
+ * the next step picks up where it stopped -> a big grid never stalls the frame, its currents just update less often
+ * The agents sample velX/Y/Z, the last finished solve; a solve works in its own buffers and swaps them in when it is done
+ * finishEveryStep always finishes the solve in the step it started -> a seeded run must not depend on how fast the machine is
+ */
+
+#pragma once
+
+//allolib includes
+#include "al/math/al_Random.hpp"
+#include "al/math/al_Vec.hpp"
+//c std library includes
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <vector>
+//my includes
+#include "../common/parallel.cpp"
+
+using namespace al;
+using namespace std;
+
+// the value of f (an nx x ny x nz grid, x fastest then y then z, at least 2 points per axis) at grid coordinates (u, v, w),
+// blended from the 8 grid points around it, coordinates outside the grid get the value at its edge
+// no branches, so loops over it vectorize (flow_volume.cpp samples its frames with it too)
+inline float trilinear(const float* f, int nx, int ny, int nz, float u, float v, float w) {
+  u = min(max(u, 0.0f), (float)(nx - 1)); v = min(max(v, 0.0f), (float)(ny - 1)); w = min(max(w, 0.0f), (float)(nz - 1));
+  int i0 = min((int)u, nx - 2), j0 = min((int)v, ny - 2), k0 = min((int)w, nz - 2);
+  float tx = u - i0, ty = v - j0, tz = w - k0;
+  int dy = nx, dz = nx * ny;
+  int c = (k0 * ny + j0) * nx + i0; // the lower corner, the other 7 are +1, +dy, +dz away
+  float f00 = f[c] + (f[c + 1] - f[c]) * tx;
+  float f10 = f[c + dy] + (f[c + dy + 1] - f[c + dy]) * tx;
+  float f01 = f[c + dz] + (f[c + dz + 1] - f[c + dz]) * tx;
+  float f11 = f[c + dy + dz] + (f[c + dy + dz + 1] - f[c + dy + dz]) * tx;
+  float f0 = f00 + (f10 - f00) * ty;
+  float f1 = f01 + (f11 - f01) * ty;
+  return f0 + (f1 - f0) * tz;
+}
+
+struct Fluid {
+  int side = 8; // grid points along each axis (at least 3, the outer ones are walls)
+  float extent = 1; // the grid goes from -extent to extent on every axis
+  vector<float> velX, velY, velZ; // the velocity at every grid point, x fastest then y then z -> this is the force on the agents
+  vector<float> workX, workY, workZ; // the velocity the current solve is working on
+  vector<float> prevX, prevY, prevZ; // the velocity before the current pass
+  vector<float> pressure, pressureNext, divergence;
+
+  float viscosity = 0.0005; // how quickly the currents smear out
+  float speed = 1; // world units per second a velocity of 1 carries the fluid
+  int stirs = 4; // random pushes per solve, they keep the currents going
+  float stirStrength = 40; // how hard a stir pushes (velocity per second at its center)
+  float stirRadius = 0.2; // how big a stir is, in world units
+  int maxIterations = 20; // Jacobi iterations per diffusion / pressure solve
+  float budgetMs = 4; // how long step() may work on the solve
+  bool finishEveryStep = false; // true -> ignore the budget, every step runs a whole solve
+
+  // the solve in progress: a list of passes, each runs slice(k) for every z slice and then finish()
+  struct Pass {
+    function<void(int)> slice;
+    function<void()> finish;
+  };
+  vector<Pass> passes;
+  int pass = 0, nextSlice = 0; // where the solve stopped
+  bool solving = false;
+  double pendingDt = 0; // time that passed since the current solve started, the next solve covers it
+  int stepsThisSolve = 0, lastSolveSteps = 0; // how many steps the last solve was spread over
+
+  vector<Vec3f> stirCenters, stirPushes; // the stirs of the current solve
+
+  int index(int i, int j, int k) const { return (k * side + j) * side + i; }
+  float spacing() const { return 2 * extent / (side - 1); }
+  bool inner(int k) const { return k > 0 && k < side - 1; }
+
+  void make(int s, rnd::Random<>& rng) { // a random field, made incompressible
+    side = max(s, 3);
+    int n = side * side * side;
+    for (vector<float>* v : {&velX, &velY, &velZ, &workX, &workY, &workZ, &prevX, &prevY, &prevZ,
+                             &pressure, &pressureNext, &divergence}) {
+      v->assign(n, 0.0f);
+    }
+    for (int i = 0; i < n; i++) {
+      velX[i] = rng.uniformS(); velY[i] = rng.uniformS(); velZ[i] = rng.uniformS();
+    }
+    pendingDt = 0;
+    stepsThisSolve = lastSolveSteps = 0;
+    begin(0, rng, false); // no time passes -> no stirs, no diffusion, no advection, just the projection
+    run(chrono::steady_clock::time_point::max());
+  }
+
+  //***********************************************************************
+  // sampling
+
+  float trilinear(const float* f, float u, float v, float w) const { return ::trilinear(f, side, side, side, u, v, w); }
+
+  // the velocity at the positions of ids (x[id], y[id], z[id]) -> out*[k] for ids[k], positions outside the box get the velocity at the wall
+  void sample(const vector<int>& ids, const float* x, const float* y, const float* z,
+              float* outX, float* outY, float* outZ) const {
+    const float scale = 1 / spacing(); // position -> grid coordinate
+    const float *fx = velX.data(), *fy = velY.data(), *fz = velZ.data();
+    parallelFor(ids.size(), 4096, [&](int begin, int end) {
+      for (int k = begin; k < end; k++) {
+        int id = ids[k];
+        float u = (x[id] + extent) * scale, v = (y[id] + extent) * scale, w = (z[id] + extent) * scale;
+        outX[k] = trilinear(fx, u, v, w);
+        outY[k] = trilinear(fy, u, v, w);
+        outZ[k] = trilinear(fz, u, v, w);
+      }
+    });
+  }
+
+  //***********************************************************************
+  // stepping
+
+  void step(float dt, rnd::Random<>& rng) {
+    auto deadline = chrono::steady_clock::now() + chrono::microseconds((long long)(budgetMs * 1000));
+    if (finishEveryStep) { deadline = chrono::steady_clock::time_point::max(); }
+    pendingDt += dt;
+    if (!solving) { // the last solve is done, start the next one over the time since the last one started
+      begin(pendingDt, rng, true);
+      pendingDt = 0;
+    }
+    stepsThisSolve++;
+    run(deadline);
+  }
+
+  // work on the solve until it is done (-> true) or the deadline passed
+  bool run(chrono::steady_clock::time_point deadline) {
+    int chunk = max(parallelThreads(), 32768 / (side * side)); // slices between looks at the clock
+    while (pass < (int)passes.size()) {
+      Pass& p = passes[pass];
+      int first = nextSlice, count = min(chunk, side - first);
+      parallelFor(count, 1, [&](int begin, int end) {
+        for (int k = begin; k < end; k++) { p.slice(first + k); }
+      });
+      nextSlice += count;
+      if (nextSlice == side) {
+        if (p.finish) { p.finish(); }
+        pass++;
+        nextSlice = 0;
+      }
+      if (pass < (int)passes.size() && chrono::steady_clock::now() > deadline) { return false; }
+    }
+    solving = false;
+    lastSolveSteps = stepsThisSolve;
+    stepsThisSolve = 0;
+    return true;
+  }
+
+  // set up the passes of one solve over dt seconds
+  void begin(float dt, rnd::Random<>& rng, bool stirring) {
+    passes.clear();
+    pass = nextSlice = 0;
+    solving = true;
+
+    stirCenters.clear(); stirPushes.clear();
+    for (int s = 0; stirring && s < stirs; s++) {
+      Vec3f center(rng.uniformS() * extent, rng.uniformS() * extent, rng.uniformS() * extent);
+      Vec3f push(rng.uniformS(), rng.uniformS(), rng.uniformS());
+      stirCenters.push_back(center);
+      stirPushes.push_back(push.normalize() * (stirStrength * dt));
+    }
+    passes.push_back({[this](int k) { stirSlice(k); }, nullptr}); // prev = vel + stirs
+
+    if (viscosity > 0 && dt > 0) { // work = prev smeared out by the viscosity (implicit, so it is stable), then back into prev
+      float h = spacing();
+      float a = dt * viscosity / (h * h);
+      float inverse = 1 / (1 + 6 * a);
+      vector<float>* work[3] = {&workX, &workY, &workZ};
+      vector<float>* prev[3] = {&prevX, &prevY, &prevZ};
+      for (int d = 0; d < 3; d++) {
+        vector<float>* w = work[d];
+        vector<float>* b = prev[d];
+        for (int it = 0; it < maxIterations; it++) {
+          vector<float>* x = it == 0 ? b : w; // start from where we were
+          passes.push_back({[this, x, b, a, inverse](int k) { jacobiSlice(*x, *b, pressureNext, a, inverse, k); }, // pressureNext is free scratch here
+                            [this, w, d]() { swap(*w, pressureNext); setBoundary(*w, d); }});
+        }
+      }
+      passes.back().finish = [this, finish = passes.back().finish]() {
+        finish();
+        swap(workX, prevX); swap(workY, prevY); swap(workZ, prevZ);
+      };
+    }
+
+    float back = dt * speed / spacing(); // velocity -> grid points moved
+    passes.push_back({[this, back](int k) { advectSlice(back, k); }, // work = prev, carried along by prev
+                      [this]() { setBoundary(workX, 0); setBoundary(workY, 1); setBoundary(workZ, 2); }});
+
+    // remove the divergence of work: solve for the pressure, subtract its gradient
+    passes.push_back({[this](int k) { divergenceSlice(k); }, [this]() { setBoundary(divergence, -1); }});
+    for (int it = 0; it < maxIterations; it++) { // the pressure of the last solve is a good first guess, it changes slowly
+      passes.push_back({[this](int k) { jacobiSlice(pressure, divergence, pressureNext, 1, 1.0f / 6, k); },
+                        [this]() { swap(pressure, pressureNext); setBoundary(pressure, -1); }});
+    }
+    passes.push_back({[this](int k) { gradientSlice(k); },
+                      [this]() { // done -> this is the field the agents see now
+                        setBoundary(workX, 0); setBoundary(workY, 1); setBoundary(workZ, 2);
+                        swap(velX, workX); swap(velY, workY); swap(velZ, workZ);
+                      }});
+  }
+
+  //***********************************************************************
+  // the passes, one z slice at a time
+
+  void stirSlice(int k) { // prev = vel, pushed at a few places with a smooth falloff
+    int row = index(0, 0, k), n = side * side;
+    copy(velX.begin() + row, velX.begin() + row + n, prevX.begin() + row);
+    copy(velY.begin() + row, velY.begin() + row + n, prevY.begin() + row);
+    copy(velZ.begin() + row, velZ.begin() + row + n, prevZ.begin() + row);
+    if (!inner(k)) { return; }
+    float h = spacing();
+    int reach = max(1, (int)ceil(2 * stirRadius / h));
+    for (int s = 0; s < (int)stirCenters.size(); s++) {
+      Vec3f center = stirCenters[s], push = stirPushes[s];
+      int ci = (center.x + extent) / h, cj = (center.y + extent) / h, ck = (center.z + extent) / h;
+      if (abs(k - ck) > reach) { continue; }
+      for (int j = max(1, cj - reach); j <= min(side - 2, cj + reach); j++) {
+        for (int i = max(1, ci - reach); i <= min(side - 2, ci + reach); i++) {
+          Vec3f p(i * h - extent, j * h - extent, k * h - extent);
+          float falloff = exp(-(p - center).magSqr() / (stirRadius * stirRadius));
+          int c = index(i, j, k);
+          prevX[c] += push.x * falloff; prevY[c] += push.y * falloff; prevZ[c] += push.z * falloff;
+        }
+      }
+    }
+  }
+
+  // one Jacobi sweep of x = (b + a * (sum of x's 6 neighbors)) * inverse, into out
+  void jacobiSlice(const vector<float>& x, const vector<float>& b, vector<float>& out, float a, float inverse, int k) {
+    if (!inner(k)) { return; }
+    const float* xs = x.data();
+    const float* bs = b.data();
+    float* o = out.data();
+    int dy = side, dz = side * side;
+    for (int j = 1; j < side - 1; j++) {
+      int row = index(0, j, k);
+      for (int i = 1; i < side - 1; i++) { // the stencil -> contiguous in i, vectorizes
+        int c = row + i;
+        o[c] = (bs[c] + a * (xs[c - 1] + xs[c + 1] + xs[c - dy] + xs[c + dy] + xs[c - dz] + xs[c + dz])) * inverse;
+      }
+    }
+  }
+
+  void advectSlice(float back, int k) { // trace every grid point back to where its fluid came from
+    if (!inner(k)) { return; }
+    for (int j = 1; j < side - 1; j++) {
+      for (int i = 1; i < side - 1; i++) {
+        int c = index(i, j, k);
+        float u = i - back * prevX[c], v = j - back * prevY[c], w = k - back * prevZ[c];
+        workX[c] = trilinear(prevX.data(), u, v, w);
+        workY[c] = trilinear(prevY.data(), u, v, w);
+        workZ[c] = trilinear(prevZ.data(), u, v, w);
+      }
+    }
+  }
+
+  void divergenceSlice(int k) {
+    if (!inner(k)) { return; }
+    float h = spacing();
+    int dy = side, dz = side * side;
+    for (int j = 1; j < side - 1; j++) {
+      int row = index(0, j, k);
+      for (int i = 1; i < side - 1; i++) {
+        int c = row + i;
+        divergence[c] = -0.5f * h * (workX[c + 1] - workX[c - 1] + workY[c + dy] - workY[c - dy] + workZ[c + dz] - workZ[c - dz]);
+      }
+    }
+  }
+
+  void gradientSlice(int k) {
+    if (!inner(k)) { return; }
+    float scale = 0.5f / spacing();
+    int dy = side, dz = side * side;
+    for (int j = 1; j < side - 1; j++) {
+      int row = index(0, j, k);
+      for (int i = 1; i < side - 1; i++) {
+        int c = row + i;
+        workX[c] -= scale * (pressure[c + 1] - pressure[c - 1]);
+        workY[c] -= scale * (pressure[c + dy] - pressure[c - dy]);
+        workZ[c] -= scale * (pressure[c + dz] - pressure[c - dz]);
+      }
+    }
+  }
+
+  // the walls: the grid points on the outside copy their inner neighbor, and the velocity into the wall is flipped
+  // axis is the velocity component f holds (0, 1, 2), or -1 for a plain value like the pressure
+  void setBoundary(vector<float>& f, int axis) {
+    int n = side - 1;
+    for (int a = 0; a < side; a++) {
+      for (int b = 0; b < side; b++) {
+        f[index(0, a, b)] = axis == 0 ? -f[index(1, a, b)] : f[index(1, a, b)];
+        f[index(n, a, b)] = axis == 0 ? -f[index(n - 1, a, b)] : f[index(n - 1, a, b)];
+        f[index(a, 0, b)] = axis == 1 ? -f[index(a, 1, b)] : f[index(a, 1, b)];
+        f[index(a, n, b)] = axis == 1 ? -f[index(a, n - 1, b)] : f[index(a, n - 1, b)];
+        f[index(a, b, 0)] = axis == 2 ? -f[index(a, b, 1)] : f[index(a, b, 1)];
+        f[index(a, b, n)] = axis == 2 ? -f[index(a, b, n - 1)] : f[index(a, b, n - 1)];
+      }
+    }
+  }
+};
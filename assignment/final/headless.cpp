@@ -0,0 +1,79 @@
+/* headless.cpp
+ * Runs the simulation (simulation.cpp) without a window, an audio device or Cuttlebone
+ * This is for profiling and for measuring how many ticks per second the simulation can do on a headless machine
+ *
+ * Usage: headless [--steps N] [--dt seconds] [--report N] [--trace file] [--agents N] [--capacity N] [--food N] [--foodCapacity N] [--grid dense|hashed] [--worldSize N] [--sortInterval N] [--fieldResolution N] [--fieldSize N] [--fluidBudget ms] [--fluidIterations N] [--viscosity N] [--flowVolume file] [--flowRate N] [--flowStrength N] [--threads N] [--pinThreads 0|1] [--flockingKernel simd|scalar|validate] [--seed N] [--config file]
+ *   --steps   how many steps to run (default 1000)
+ *   --dt      the dt passed to every step (default 1/60)
+ *   --report  print a progress line every N steps (default 0, only the summary)
+ *   --trace   write the tracing zones of the run (the last 64k per thread) to a chrome://tracing json file
+ *   the rest size and seed the simulation (SimulationConfig in simulation.cpp)
+ *   --flockingKernel validate prints how far the flocking kernel got from the scalar code
+ *   --seed    the same seed (and size) gives exactly the same run (compare the printed state hash)
+ *             without it, a random seed is picked and printed so the run can be repeated
+ */
+
+//c std library includes
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+//my includes
+#include "simulation.cpp"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+  int steps = 1000;
+  double dt = 1.0 / 60.0;
+  int report = 0;
+  const char* tracePath = nullptr;
+  SimulationConfig config;
+  bool ok = true;
+  for (int i = 1; i < argc; i++) {
+    if (config.parseArg(argc, argv, i, ok)) { continue; }
+    if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc) { steps = atoi(argv[++i]); }
+    else if (strcmp(argv[i], "--dt") == 0 && i + 1 < argc) { dt = atof(argv[++i]); }
+    else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) { report = atoi(argv[++i]); }
+    else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) { tracePath = argv[++i]; }
+    else { ok = false; }
+  }
+  if (!ok || !config.valid()) {
+    cerr << "usage: " << argv[0] << " [--steps N] [--dt seconds] [--report N] [--trace file] " << SimulationConfig::usage() << endl;
+    return 1;
+  }
+
+  TRACE_THREAD_NAME("simulation");
+  unique_ptr<Simulation> simulation(new Simulation(config)); // the hanning window is big, keep it off the stack
+  simulation->reset();
+  cout << "seed: " << simulation->seed << ", agents: " << config.agents << " (capacity " << simulation->agents.capacity
+       << "), food: " << config.food << endl;
+
+  auto start = chrono::steady_clock::now();
+  for (int i = 1; i <= steps; i++) {
+    simulation->step(dt);
+    if (report > 0 && i % report == 0) {
+      double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+      cout << "step " << i << ": " << i / seconds << " ticks/s, "
+           << simulation->aliveAgents << " agents, "
+           << simulation->field.getAmountOfFood() << " food" << endl;
+    }
+  }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  cout << steps << " steps in " << seconds << " s -> " << steps / seconds << " ticks/s" << endl;
+  cout << "alive agents: " << simulation->aliveAgents << ", food: " << simulation->field.getAmountOfFood();
+  if (simulation->field.volume.isOpen()) { cout << ", flow volume at frame " << simulation->field.volume.frameOf[simulation->field.volume.current] << endl; }
+  else { cout << ", fluid solve took " << simulation->field.fluid.lastSolveSteps << " steps" << endl; }
+  if (simulation->flockingMode == Simulation::FLOCK_VALIDATE) {
+    cout << "flocking kernel vs scalar: largest difference " << simulation->flockingError << endl;
+  }
+  cout << "state hash: " << hex << simulation->stateHash() << dec << endl;
+
+  if (tracePath) {
+    if (Tracer::instance().writeChromeTrace(tracePath)) { cout << "wrote " << tracePath << endl; }
+    else { cerr << "could not write " << tracePath << endl; return 1; }
+  }
+  return 0;
+}
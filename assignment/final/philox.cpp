@@ -0,0 +1,72 @@
+/* philox.cpp
+ * This file describes Philox, a counter-based random generator (Philox4x32-10, Salmon et al., "Parallel random numbers: as easy as 1, 2, 3")
+ * A random number is a pure function of (key, counter): the key is the run's seed, the counter says which number it is
+ *   -> the counter is (agent id, frame, purpose, n), so every agent has its own stream for every purpose in every frame
+ * Nothing is shared between the streams, so the agents can draw their numbers in any order, on any thread,
+ * and a seeded run comes out the same at any thread count
+ * It can stand in for rnd::Random<> (operator(), uniform(), uniformS(), uniform(hi, lo), seed())
+ */
+
+#pragma once
+
+//c std library includes
+#include <cstdint>
+
+struct Philox {
+  uint32_t key[2] = {0, 0};
+  uint32_t counter[4] = {0, 0, 0, 0}; // {n, id, frame, purpose}, n counts the blocks drawn so far
+  uint32_t block[4];
+  int used = 4; // how many numbers of block were handed out
+
+  Philox() {}
+  Philox(uint32_t seed, uint32_t id, uint32_t frame, uint32_t purpose) {
+    key[0] = seed;
+    counter[1] = id;
+    counter[2] = frame;
+    counter[3] = purpose;
+  }
+
+  void seed(uint32_t s) { // a stream of its own for whoever holds this generator (the impulse generators use that)
+    key[0] = s;
+    counter[0] = counter[1] = counter[2] = counter[3] = 0;
+    used = 4;
+  }
+
+  // the four numbers at counter c -> ten rounds of multiply, swap and xor with the key
+  static void generate(const uint32_t c[4], const uint32_t k[2], uint32_t out[4]) {
+    uint32_t x0 = c[0], x1 = c[1], x2 = c[2], x3 = c[3];
+    uint32_t k0 = k[0], k1 = k[1];
+    for (int round = 0; round < 10; round++) {
+      uint64_t p0 = (uint64_t)0xD2511F53u * x0;
+      uint64_t p1 = (uint64_t)0xCD9E8D57u * x2;
+      uint32_t y0 = (uint32_t)(p1 >> 32) ^ x1 ^ k0;
+      uint32_t y2 = (uint32_t)(p0 >> 32) ^ x3 ^ k1;
+      x0 = y0; x1 = (uint32_t)p1; x2 = y2; x3 = (uint32_t)p0;
+      k0 += 0x9E3779B9u; k1 += 0xBB67AE85u;
+    }
+    out[0] = x0; out[1] = x1; out[2] = x2; out[3] = x3;
+  }
+
+  uint32_t operator()() {
+    if (used == 4) {
+      generate(counter, key, block);
+      counter[0]++;
+      used = 0;
+    }
+    return block[used++];
+  }
+
+  // the same ranges as rnd::Random<>
+  float uniform() { return ((*this)() >> 8) * (1.0f / 16777216.0f); } // [0, 1)
+  float uniformS() { return uniform() * 2.0f - 1.0f; } // [-1, 1)
+  template <class T>
+  T uniform(const T& hi, const T& lo) { return T((hi - lo) * uniform()) + lo; }
+
+  // one number in [0, 1) without keeping a stream -> for loops that draw a single number per agent
+  // (no state between the iterations, so such a loop can be split over threads or vectorized as it is)
+  static float uniformAt(uint32_t seed, uint32_t id, uint32_t frame, uint32_t purpose) {
+    uint32_t c[4] = {0, id, frame, purpose}, k[2] = {seed, 0}, out[4];
+    generate(c, k, out);
+    return (out[0] >> 8) * (1.0f / 16777216.0f);
+  }
+};
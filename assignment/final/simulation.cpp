@@ -0,0 +1,769 @@
+/* simulation.cpp
+ * This file describes the simulation engine -> everything that evolves the agents and the field
+ * The simulation has no window, audio device or Cuttlebone in it, so it can be stepped from the app (final.cpp)
+ * or from the headless runner (headless.cpp)
+ * Call reset() once to fill the agents and the field, then step(dt) once per frame
+ * Every random number is drawn from the simulation's own generators (rng here, and field.rng), seeded in reset()
+ * What an agent draws for itself (fitness, reproduction, being culled, being born) comes from its own Philox stream (philox.cpp),
+ * keyed by (run, agent id, frame, purpose) -> those loops don't depend on the order the agents are visited in, or on the thread count
+ * -> after setSeed(s), every reset() replays exactly the same run for the same agent and food counts
+ *    (the only thing from outside that changes a run is Agent::isChirping, which the audio thread sets)
+ * How big the simulation is (agents, capacity, food) is a SimulationConfig, read from the command line or a config file at startup
+ */
+
+#pragma once
+
+//allolib includes
+#include "al/math/al_Random.hpp"
+#include "al/math/al_Vec.hpp"
+#include "al/spatial/al_Pose.hpp"
+#include "al/types/al_Color.hpp"
+//c std library includes
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+//my includes
+#include "agent.cpp"
+#include "philox.cpp"
+#include "agent_store.cpp"
+#include "field.cpp"
+#include "flocking_kernel.cpp"
+#include "spatial_grid.cpp"
+#include "state.cpp"
+#include "trace.cpp"
+
+using namespace al;
+using namespace std;
+
+// everything the simulation reads from the gui -> the app copies its Parameters in here every frame
+struct SimulationParams {
+  //flocking params
+  int k = 5;
+  float localRadius = 0.18;
+  float rate = 0.015;
+  int sortInterval = 60; // every this many steps the agents are sorted in Morton order (AgentStore::sortByMorton), 0 -> never
+  //evolution params
+  float reproductionDistanceThreshold = 0.05;
+  float foodDistanceThreshold = 0.05; // have to be this far away to eat food
+  float decreaseLifespanAmount = 0.01;
+  float reproductionProbabilityThreshold = 200;
+};
+
+// how big the simulation is -> chosen once at startup, shared by the app, headless.cpp and benchmark.cpp
+// command line: --agents N --capacity N --food N --foodCapacity N --grid dense|hashed --worldSize N --sortInterval N --fieldResolution N --fieldSize N
+//               --fluidBudget ms --fluidIterations N --viscosity N --flowVolume file --flowRate N --flowStrength N --threads N --pinThreads 0|1 --flockingKernel simd|scalar|validate --seed N --config file
+// config file: one "key value" per line with the same keys (agents 100000), # starts a comment
+struct SimulationConfig {
+  int agents = 500; // how many agents the simulation starts with
+  int capacity = 0; // the most agents there can ever be alive at once (0 -> same as agents), the pools grow up to this
+  int food = 500; // how much food the field starts with
+  int foodCapacity = 0; // the most food there can ever be (0 -> same as food)
+  bool hashedGrid = false; // the agents' neighbor grid: false -> a dense box of cells, true -> hashed cells for worlds without bounds
+  float worldSize = 1; // the dense grid covers -worldSize..worldSize (agents outside it still work, they just share the edge cells)
+  int sortInterval = 60; // sort the agents in Morton order every this many steps (SimulationParams::sortInterval), 0 -> never
+  int fieldResolution = 8; // grid points along each axis of the flow field
+  float fieldSize = 1; // the flow field covers -fieldSize..fieldSize
+  float fluidBudget = 4; // ms the fluid solver may work per step, a big grid spreads a solve over several steps (unseeded runs only)
+  int fluidIterations = 20; // Jacobi iterations of the fluid's diffusion and pressure solves
+  float viscosity = 0.0005;
+  string flowVolume; // a volume file (flow_volume.cpp) -> the agents follow its flow instead of the fluid solver
+  float flowRate = 1; // playback speed of the volume
+  float flowStrength = 1; // the volume's velocities are scaled by this
+  int threads = 0; // threads the simulation runs on (parallel.cpp), 0 -> one per hardware thread
+  bool pinThreads = false; // pin every worker thread to a core of its own (linux only)
+  // Simulation::FlockingMode -> the 8-wide kernel (flocking_kernel.cpp), the scalar reference, or both compared
+  // the kernel is the default only on AVX2 and arm64 NEON builds, everywhere else the scalar code is (and the seeded hashes differ between the two)
+  int flockingKernel = FLOCKING_KERNEL_VECTORIZED ? 0 : 1;
+  uint32_t seed = 0;
+  bool seeded = false; // false -> every reset picks a new seed
+
+  int agentCapacity() const { return max(capacity, agents); }
+  int foodPoolCapacity() const { return max(foodCapacity, food); }
+
+  bool set(const string& key, const char* value) { // false if the key isn't a simulation option
+    if (key == "agents") { agents = atoi(value); }
+    else if (key == "capacity") { capacity = atoi(value); }
+    else if (key == "food") { food = atoi(value); }
+    else if (key == "foodCapacity") { foodCapacity = atoi(value); }
+    else if (key == "grid") { hashedGrid = strcmp(value, "hashed") == 0; }
+    else if (key == "worldSize") { worldSize = atof(value); }
+    else if (key == "sortInterval") { sortInterval = atoi(value); }
+    else if (key == "fieldResolution") { fieldResolution = atoi(value); }
+    else if (key == "fieldSize") { fieldSize = atof(value); }
+    else if (key == "fluidBudget") { fluidBudget = atof(value); }
+    else if (key == "fluidIterations") { fluidIterations = atoi(value); }
+    else if (key == "viscosity") { viscosity = atof(value); }
+    else if (key == "flowVolume") { flowVolume = value; }
+    else if (key == "flowRate") { flowRate = atof(value); }
+    else if (key == "flowStrength") { flowStrength = atof(value); }
+    else if (key == "threads") { threads = atoi(value); }
+    else if (key == "pinThreads") { pinThreads = atoi(value) != 0; }
+    else if (key == "flockingKernel") { flockingKernel = strcmp(value, "scalar") == 0 ? 1 : strcmp(value, "validate") == 0 ? 2 : strcmp(value, "simd") == 0 ? 0 : -1; }
+    else if (key == "seed") { seed = strtoul(value, nullptr, 10); seeded = true; }
+    else { return false; }
+    return true;
+  }
+
+  bool load(const char* path) { // read a config file, false if it can't be read or has an unknown key
+    ifstream file(path);
+    if (!file.good()) { return false; }
+    string key, value;
+    while (file >> key) {
+      if (key[0] == '#') { getline(file, value); continue; }
+      if (!(file >> value) || !set(key, value.c_str())) { return false; }
+    }
+    return true;
+  }
+
+  // call this from main's argument loop -> if argv[i] is a simulation option, it is consumed (i moves past its value)
+  // and true is returned, ok is set to false if the option was broken
+  bool parseArg(int argc, char* argv[], int& i, bool& ok) {
+    if (strncmp(argv[i], "--", 2) != 0 || i + 1 >= argc) { return false; }
+    string key(argv[i] + 2);
+    if (key == "config") { ok = load(argv[++i]) && ok; return true; }
+    if (!set(key, argv[i + 1])) { return false; }
+    i++;
+    return true;
+  }
+
+  bool valid() const {
+    return agents >= 1 && food >= 0 && capacity >= 0 && foodCapacity >= 0 && worldSize > 0 && sortInterval >= 0
+        && fieldResolution >= 3 && fieldSize > 0 && fluidBudget >= 0 && fluidIterations >= 1 && viscosity >= 0
+        && flowRate >= 0 && threads >= 0 && flockingKernel >= 0;
+  }
+
+  string describe() const { // the options that change how fast a step runs, in config file form ("key value  key value ...")
+    static const char* kernels[] = {"simd", "scalar", "validate"};
+    string s = "agents " + to_string(agents) + "  capacity " + to_string(agentCapacity()) + "  food " + to_string(food)
+             + "  grid " + (hashedGrid ? "hashed" : "dense") + "  sortInterval " + to_string(sortInterval)
+             + "  fieldResolution " + to_string(fieldResolution) + "  fluidIterations " + to_string(fluidIterations)
+             + "  threads " + to_string(threads > 0 ? threads : parallelThreads()) + "  pinThreads " + to_string((int)pinThreads)
+             + "  flockingKernel " + (flockingKernel >= 0 && flockingKernel <= 2 ? kernels[flockingKernel] : "?");
+    if (!flowVolume.empty()) { s += "  flowVolume " + flowVolume; }
+    if (seeded) { s += "  seed " + to_string(seed); }
+    return s;
+  }
+
+  static const char* usage() {
+    return "[--agents N] [--capacity N] [--food N] [--foodCapacity N] [--grid dense|hashed] [--worldSize N] [--sortInterval N] [--fieldResolution N] [--fieldSize N] [--fluidBudget ms] [--fluidIterations N] [--viscosity N] [--flowVolume file] [--flowRate N] [--flowStrength N] [--threads N] [--pinThreads 0|1] [--flockingKernel simd|scalar|validate] [--seed N] [--config file]";
+  }
+};
+
+struct Simulation {
+  // the phases of a step -> step() runs them as a task graph (buildStepGraph), each one as soon as the phases it depends on are done
+  // phases that touch different data (the food, the fluid, the agents) run at the same time, and the loops over the agents
+  // inside a phase are split over the thread pool (parallel.cpp); every phase that draws random numbers still runs on its own
+  // this order is one the graph allows -> benchmark.cpp runs (and times) them one by one in it with runPhase(), same result
+  enum Phase {
+    RESPAWN_FOOD,
+    SORT_AGENTS,
+    FIND_NEIGHBORS,
+    CULL, // right after FIND_NEIGHBORS, while agentGrid still has every agent where it is
+    CALC_FLOCKING,
+    ALIGNMENT_AND_COHESION,
+    ASSIGN_FITNESS,
+    REPRODUCE,
+    CHECK_AGENT_DEATH,
+    EAT_FOOD,
+    MOVE_FOOD,
+    UPDATE_FOOD,
+    UPDATE_FLUID, // before APPLY_FORCES -> the agents are pushed by the fluid of this step
+    APPLY_FORCES,
+    PHASE_COUNT
+  };
+
+  int initialAgents; // how many agents reset() makes
+  AgentStore agents; // data structure that stores the agents in the system (one array per attribute), grows up to agents.capacity
+  vector<Genome> tempNewAgents; // this a temporary vector that holds the genomes of all the new agents that are to be added in the system after reproduction
+  // they are all spawned into free slots in checkAgentDeath, in the order that they were created
+  Field field; // field
+  SpatialGrid agentGrid; // spatial lookup for the flocking neighbors (and the culls, forEachAgentWithin)
+  vector<int> inRange; // scratch for forEachAgentWithin
+  vector<uint8_t> inRangeMask;
+  vector<unsigned> rangeCells;
+  NeighborTable neighbors; // every live agent's k nearest neighbors, found once a frame (findNeighbors) for flocking and reproduction
+  float hanningWindow[1024]; //this is the hanning window passed to each agent for their chirplet sound
+  SimulationParams params;
+  vector<float> forceX, forceY, forceZ; // scratch for applyForces: the field's force at every live agent
+  vector<int> foodFound; // scratch for eatFood: the food every live agent found, -1 if none
+  vector<int> birthOffset; // scratch for reproduce: where every live agent's offspring go in tempNewAgents
+  enum FlockingMode { FLOCK_SIMD, FLOCK_SCALAR, FLOCK_VALIDATE }; // SimulationConfig::flockingKernel
+  FlockingMode flockingMode = FLOCK_SCALAR;
+  FlockingKernel flockingKernel; // calcFlocking and alignmentAndCohesion 8 agents at a time
+  float flockingError = 0; // FLOCK_VALIDATE: the largest difference between the kernel and the scalar code so far
+  TaskGraph stepGraph; // the phases and what each waits for
+
+  rnd::Random<> rng; // everything random in the simulation as a whole comes from here (the culls, the seeds of the other generators)
+  uint32_t streamKey = 0; // the key of the agents' own Philox streams (agentRandom), drawn from rng in reset()
+  enum RandomPurpose { FIRST_AGENTS, FITNESS, REPRODUCTION, GENOME, BIRTH, CULL_CHANCE }; // an agent has one stream per purpose per frame
+  uint32_t seed = 0; // the seed of the current run -> pass it to setSeed() to run it again
+  bool fixedSeed = false; // true -> every reset() replays the same run, false -> every reset() picks a new seed
+
+  float timing = 1; // how often does the culling happen from the environment?
+  const float FITNESS_CUTOFF = 100.0; // what is the cutoff for a "fit" agent?
+  unsigned counter = 0; // how many steps have been taken
+  double time = 0; // how much time has passed (sum of the dt's passed to step)
+  double dt = 1.0 / 60.0; // the dt of the current step
+  int aliveAgents; // how many agents were alive after the last step
+
+  //the last cull -> kept so that the app can visualize it
+  bool culled = false; // true if a cull happened during the last step
+  Vec3f cullPosition;
+  float cullRadius = 0;
+  Color cullColor;
+
+  Simulation(const SimulationConfig& config = SimulationConfig())
+    : initialAgents(config.agents), aliveAgents(config.agents) {
+    agentGrid.mode = config.hashedGrid ? SpatialGrid::HASHED : SpatialGrid::DENSE;
+    agentGrid.worldSize = config.worldSize;
+    params.sortInterval = config.sortInterval;
+    agents.init(config.agents, config.agentCapacity());
+    field.initialAmountOfFood = config.food;
+    field.foodCapacity = config.foodPoolCapacity();
+    field.fluid.side = config.fieldResolution;
+    field.fluid.extent = config.fieldSize;
+    field.fluid.budgetMs = config.fluidBudget;
+    field.fluid.maxIterations = config.fluidIterations;
+    field.fluid.viscosity = config.viscosity;
+    if (!config.flowVolume.empty() && !field.volume.open(config.flowVolume)) {
+      cerr << "using the fluid solver instead of the flow volume" << endl;
+    }
+    field.volume.playbackRate = config.flowRate;
+    field.volume.strength = config.flowStrength;
+    if (config.threads > 0) { setParallelThreads(config.threads); }
+    setParallelPinning(config.pinThreads);
+    flockingMode = (FlockingMode)config.flockingKernel;
+    if (config.seeded) { setSeed(config.seed); }
+    //fill the hanning window, it is passed to each agent
+    for (int i = 0; i < 1024; i++) {
+      hanningWindow[i] = 0.5f * (1.0f - cos((2.0f * 3.1415926 * (i/1024.0f)))/1.0f);
+    }
+    buildStepGraph();
+  }
+
+  // which phases wait for which -> two phases without a path between them must not touch the same data (or draw from the same rng)
+  //   food:   respawnFood -> eatFood -> moveFood -> updateFood              (field.rng)
+  //   agents: sortAgents -> findNeighbors -> cull -> calcFlocking -> alignmentAndCohesion -> assignFitness -> reproduce
+  //           -> checkAgentDeath -> eatFood -> applyForces                   (rng)
+  //   fluid:  updateFluid -> applyForces                                    (field.fluidRng)
+  void buildStepGraph() {
+    int task[PHASE_COUNT];
+    auto add = [&](Phase phase, vector<int> after) {
+      task[phase] = stepGraph.add(phaseName(phase), [this, phase]() { runPhase(phase); }, after);
+    };
+    add(RESPAWN_FOOD, {});
+    add(UPDATE_FLUID, {});
+    add(SORT_AGENTS, {});
+    add(FIND_NEIGHBORS, {task[SORT_AGENTS]});
+    add(CULL, {task[FIND_NEIGHBORS]});
+    add(CALC_FLOCKING, {task[CULL]});
+    add(ALIGNMENT_AND_COHESION, {task[CALC_FLOCKING]});
+    add(ASSIGN_FITNESS, {task[ALIGNMENT_AND_COHESION]});
+    add(REPRODUCE, {task[ASSIGN_FITNESS]});
+    add(CHECK_AGENT_DEATH, {task[REPRODUCE]});
+    add(EAT_FOOD, {task[CHECK_AGENT_DEATH], task[RESPAWN_FOOD]});
+    add(MOVE_FOOD, {task[EAT_FOOD]});
+    add(UPDATE_FOOD, {task[MOVE_FOOD]});
+    add(APPLY_FORCES, {task[EAT_FOOD], task[UPDATE_FLUID]});
+  }
+
+  //***********************************************************************
+  // reset
+
+  void setSeed(uint32_t s) { // reproducible runs from the next reset() on
+    seed = s;
+    fixedSeed = true;
+  }
+
+  void reset() { // completely new agents and a fresh field
+    if (!fixedSeed) { seed = random_device()(); }
+    rng.seed(seed);
+    field.rng.seed(rng());
+    field.fluidRng.seed(rng());
+    streamKey = rng();
+    field.fluid.finishEveryStep = fixedSeed; // the time budget would make seeded runs depend on the machine
+    field.volume.waitForFrames = fixedSeed; // and so would holding a frame until the disk catches up
+    timing = rng.uniform(1,1000);
+    counter = 0;
+    time = 0;
+
+    //clear the baby vector
+    tempNewAgents.clear();
+    tempNewAgents.resize(0);
+    //push completely new agents
+    //the pools never shrink (the audio thread may be reading the voices), slots a previous run grew are just killed
+    agents.grow(initialAgents);
+    agents.clear();
+    for (int i = 0; i < initialAgents; i++) {
+      Philox random(streamKey, i, 0, FIRST_AGENTS);
+      Agent a(random);
+      a.chirp.setWindowPtr(hanningWindow);
+      agents.set(i, a);
+    }
+    for (int i = agents.size - 1; i >= initialAgents; i--) { agents.kill(i); }
+    aliveAgents = initialAgents;
+
+    field.resetField(); //initializes the field (fills the food array, initializes forces)
+  }
+
+  //***********************************************************************
+  // step -> one frame of the simulation
+
+  void step(double dt) {
+    TRACE_SCOPE("step");
+    beginStep(dt);
+    stepGraph.run();
+  }
+
+  // the bookkeeping every step starts with, before its phases run (step(), or the phases one at a time in benchmark.cpp)
+  void beginStep(double dt) {
+    counter++;
+    time += dt;
+    this->dt = dt;
+    culled = false;
+  }
+
+  void runPhase(Phase phase) {
+    TRACE_SCOPE(phaseName(phase)); // every phase is its own zone in the trace
+    switch (phase) {
+      //update the food
+      case RESPAWN_FOOD: respawnFood(); break;
+      //update agents
+      case SORT_AGENTS: sortAgents(); break;
+      case FIND_NEIGHBORS: findNeighbors(); break;
+      case CULL: cull(); break;
+      case CALC_FLOCKING: calcFlocking(); break;
+      case ALIGNMENT_AND_COHESION: alignmentAndCohesion(); break;
+      case ASSIGN_FITNESS: assignFitness(); break;
+      case REPRODUCE: reproduce(); break;
+      case CHECK_AGENT_DEATH: checkAgentDeath(); break;
+      case EAT_FOOD: eatFood(); break;
+      //update field
+      case MOVE_FOOD: field.moveFood(); break; //move the food
+      case UPDATE_FOOD: field.updateFood(); break; //check what food was eaten and update the vector accordingly
+      case UPDATE_FLUID: field.updateFluid(dt); break; //the fluid moves on
+      case APPLY_FORCES: applyForces(); break;
+      default: break;
+    }
+  }
+
+  static const char* phaseName(Phase phase) {
+    switch (phase) {
+      case RESPAWN_FOOD: return "respawnFood";
+      case SORT_AGENTS: return "sortAgents";
+      case FIND_NEIGHBORS: return "findNeighbors";
+      case CULL: return "cull";
+      case CALC_FLOCKING: return "calcFlocking";
+      case ALIGNMENT_AND_COHESION: return "alignmentAndCohesion";
+      case ASSIGN_FITNESS: return "assignFitness";
+      case REPRODUCE: return "reproduce";
+      case CHECK_AGENT_DEATH: return "checkAgentDeath";
+      case EAT_FOOD: return "eatFood";
+      case MOVE_FOOD: return "moveFood";
+      case UPDATE_FOOD: return "updateFood";
+      case UPDATE_FLUID: return "updateFluid";
+      case APPLY_FORCES: return "applyForces";
+      default: return "unknown";
+    }
+  }
+
+  //***********************************************************************
+  // the phases of a step
+
+  void eatFood() { // if the agent is at a specific location in the environment and finds food, then increase it's lifespan
+    field.indexFood(params.foodDistanceThreshold); // only rebuilt if the food moved or changed
+    //look for food around every agent in parallel, then eat it in order
+    int n = agents.alive.size();
+    foodFound.resize(n);
+    parallelFor(n, 1024, [&](int begin, int end) {
+      for (int k = begin; k < end; k++) { //check each of the agents
+        Vec3f position = agents.position(agents.alive[k]);
+        int found = -1;
+        field.foodGrid.forEachNear(position, [&](int j, const Vec3f& foodPosition) { //check the food particles around the agent
+          float distance = Vec3f(position - foodPosition).mag();
+          if (distance < params.foodDistanceThreshold) { found = j; } //if the agent is this close to the food particle
+          return found >= 0; // the agent only eats one food particle
+        });
+        foodFound[k] = found;
+      }
+    });
+    for (int k = 0; k < n; k++) {
+      int i = agents.alive[k], j = foodFound[k];
+      if (j >= 0) {
+        field.consume(j);
+        agents.incrementLifespan(i, field.food[j].getSize()); //increase agent's lifespan by the food size
+        agents.cyclesBeforeAteFood[i] = 0; // reset food cycle counter
+      } else {
+        agents.cyclesBeforeAteFood[i]++;
+      }
+    }
+  }
+
+  void respawnFood() { // potential future TO DO: only respawn food if something is triggered in the environment
+    int foodThreshold = field.initialAmountOfFood / 2; // 250 for the default 500
+    if (field.getAmountOfFood() < foodThreshold) { //if there are less than X food particles in the field
+      field.addFood();
+    }
+  }
+
+  void applyForces() { //apply the field force on the agents located in that area
+    //sample the field at every agent at once, then push them
+    int n = agents.alive.size();
+    forceX.resize(n); forceY.resize(n); forceZ.resize(n);
+    field.sampleForces(agents.alive, agents.px.data(), agents.py.data(), agents.pz.data(), forceX.data(), forceY.data(), forceZ.data());
+    parallelFor(n, 4096, [&](int begin, int end) {
+      for (int k = begin; k < end; k++) {
+        int i = agents.alive[k];
+        agents.px[i] += forceX[k] * params.rate;
+        agents.py[i] += forceY[k] * params.rate;
+        agents.pz[i] += forceZ[k] * params.rate;
+      }
+    });
+  }
+
+  // agent i's random stream for purpose in this frame
+  Philox agentRandom(int i, RandomPurpose purpose) { return Philox(streamKey, agents.idOf[i], counter, purpose); }
+
+  //reproduce between two boids
+  // every agent rolls and looks for mates on its own (over the pool), then the births are merged in the order of agents.alive:
+  // the first pass rolls every agent's canReproduce, the second counts every agent's offspring (reading only those flags),
+  // a prefix sum gives every agent its place in tempNewAgents, and the third writes them there -> nothing is pushed to a
+  // shared vector, the births are the same at any thread count, and never more than there is room for
+  void reproduce() {
+    int n = agents.alive.size();
+    parallelFor(n, 2048, [&](int begin, int end) {
+      for (int k = begin; k < end; k++) {
+        int i = agents.alive[k];
+        Philox random = agentRandom(i, REPRODUCTION);
+        agents.checkReproduction(i, params.reproductionProbabilityThreshold, random); // check if the agents are able to reproduce (probability based)
+      }
+    });
+    birthOffset.resize(n + 1);
+    birthOffset[0] = 0;
+    parallelFor(n, 1024, [&](int begin, int end) {
+      for (int k = begin; k < end; k++) {
+        int births = 0;
+        forEachMate(agents.alive[k], [&](int) { births++; });
+        birthOffset[k + 1] = births;
+      }
+    });
+    for (int k = 0; k < n; k++) { birthOffset[k + 1] += birthOffset[k]; }
+    int room = max(0, agents.capacity - aliveAgents);
+    int births = min(birthOffset[n], room); // the first ones in alive order get the room, as if they were pushed one by one
+    tempNewAgents.resize(births);
+    parallelFor(n, 1024, [&](int begin, int end) {
+      for (int k = begin; k < end; k++) {
+        int i = agents.alive[k];
+        int next = birthOffset[k];
+        if (next < births) {
+          Philox genomeRandom = agentRandom(i, GENOME);
+          forEachMate(i, [&](int id) {
+            if (next < births) { tempNewAgents[next++] = makeGenome(i, id, genomeRandom); }
+          });
+        }
+      }
+    });
+    //reset reproduction booleans, only after every agent is done looking at the others'
+    for (int i : agents.alive) { agents.canReproduce[i] = false; }
+  }
+
+  // f(id) with agent i's mate this frame, if it has one (after the first pass of reproduce rolled everyone's canReproduce):
+  // i rolled canReproduce, its mate is the nearest live neighbor other than i, if that one is close enough
+  // (the mate doesn't have to have rolled too -> a roll needs fitness near reproductionProbabilityThreshold, and two such agents
+  // are hardly ever within reproductionDistanceThreshold of each other in the same frame, the population would die out)
+  template <class F>
+  void forEachMate(int i, F f) {
+    if (!agents.canReproduce[i]) { return; } // if they can reproduce,
+    //check nearest neighbor -> the neighbor list is sorted by distance (at findNeighbors), so the first one that qualifies is the nearest
+    int results = neighbors.count(i);
+    for (int j = 0; j < results; j++) { // these are the nearby boids
+      int id = neighbors.neighbor(i, j);
+      if (id == i || agents.isDead[id]) { continue; } // i is in its own neighbor list
+      float distance = Vec3f(  agents.position(id) - agents.position(i)  ).mag(); //check their distance (they flocked since the search)
+      if (distance < params.reproductionDistanceThreshold) { //if they are close enough, reproduce
+        f(id);
+      }
+      return; // only the nearest one
+    }
+  }
+
+  Genome makeGenome(int a, int b, Philox& random) { // the genome of the offspring of agents a and b (random is a's stream)
+    const AgentVoice& va = agents.voice(a);
+    const AgentVoice& vb = agents.voice(b);
+    Genome g;
+    g.position = (agents.position(a) + agents.position(b)) / 2;
+    g.facing = (agents.forward(a) + agents.forward(b)) / 2;
+    g.moveRate = (agents.moveRate(a) + agents.moveRate(b)) / 2;
+    g.turnRate = (agents.turnRate(a) + agents.turnRate(b)) / 2;
+    g.color = (va.color + vb.color) / 2;
+    g.centerFrequency = (va.chirp.centerFrequency + vb.chirp.centerFrequency) / 2;
+    g.range = (va.chirp.range + vb.chirp.range) / 2;
+    g.duration = (va.chirp.duration + vb.chirp.duration) / 2;
+    g.faceCount = int((va.faceCount + vb.faceCount) / 2);
+    g.spikiness = (va.spikiness + vb.spikiness) / 2;
+    if (va.chirp.up != vb.chirp.up) {
+      float rand = random.uniformS();
+      if (rand > 0) { g.up = true; } else { g.up = false; }
+    } else { g.up = va.chirp.up; }
+    return g;
+  }
+
+  void assignFitness() { //assign a fitness value to each agent based on specific rules
+    //every agent draws from its own stream and only changes itself -> split over the pool
+    parallelFor(agents.alive.size(), 2048, [&](int begin, int end) {
+      for (int k = begin; k < end; k++) {
+        int i = agents.alive[k];
+        Philox random = agentRandom(i, FITNESS);
+        //first, what is it's fitness value??
+        float valueScalar = 1.0f;
+        if (agents.fitnessValue[i] > 500) {
+          valueScalar *= 10;
+        }
+
+        float value = 0.0;
+        unsigned flockCount = agents.flockCount[i];
+        float moveRate = agents.moveRate(i).mag();
+        float turnRate = agents.turnRate(i).mag();
+        //flock count
+        if (flockCount < 5 || flockCount > 30) {
+          value -= random.uniform() * flockCount;
+        } else {
+          value += random.uniform() * flockCount; //some random relationship, but also proportional to flockCount
+        }
+        //move rate
+        if (moveRate < 0.3 || moveRate > 0.9) {
+          value -= random.uniform() * moveRate; //some random relationship, but also dependent on magnitude of moveRate
+        } else {
+          value += random.uniform() * moveRate;
+        }
+        //turn rate
+        if (turnRate < 0.3 || turnRate > 0.9) {
+          value -= random.uniform() * turnRate;
+        } else {
+          value += random.uniform() * turnRate;
+        }
+
+        value *= valueScalar;
+
+        agents.incrementFitness(i, value); //change agent's fitness value
+        agents.evaluateFitness(i, FITNESS_CUTOFF);
+      }
+    });
+  }
+
+  //check if the agent is dead -> DO THIS FOR ALL AGENTS
+  void checkAgentDeath() {
+    for (int k = agents.alive.size() - 1; k >= 0; k--) { // backwards -> a kill swaps in an agent that was already checked
+      int i = agents.alive[k];
+      if ( ( agents.lifespan[i] <= 0 || ( agents.cyclesBeforeAteFood[i] >= 600 ) ) && agents.voice(i).isChirping == false ) {
+        //if their lifespan is 0 or they haven't eaten food in 10 seconds AND they aren't in the middle of making sound, kill
+        agents.kill(i);
+      }
+    }
+
+    //every baby is born this frame, in the order they were created, into whatever slot is free (the pools grow if none is)
+    for (const Genome& genome : tempNewAgents) {
+      int slot = agents.allocate();
+      if (slot < 0) { break; } // the capacity is full, the rest aren't born
+      Philox random = agentRandom(slot, BIRTH);
+      agents.spawn(slot, genome, random, hanningWindow);
+    }
+    tempNewAgents.clear();
+
+    aliveAgents = agents.alive.size();
+  }
+
+  void cull() { // random culling from the environment
+    if (counter % (int)timing == 0) { //if it is time to cull based on timing value, then apply the culling
+      cullPosition = Vec3f(rng.uniformS(), rng.uniformS(), rng.uniformS()); //pick a random position to cull
+      cullRadius = rng.uniform() * 100.0; // pick a random radius
+      cullColor = Color(rng.uniform(), rng.uniform(), rng.uniform(), 0.3); // only used if the app visualizes the cull
+      culled = true;
+
+      // the agents in the cull position might get killed
+      forEachAgentWithin(cullPosition, cullRadius, [&](int i) {
+        agents.randomCull(i, Philox::uniformAt(streamKey, agents.idOf[i], counter, CULL_CHANCE));
+      });
+
+      timing = rng.uniform(1,1000); //reset timing
+    }
+  }
+
+  // area of effect: f(i) for every live agent closer than radius to center, in slot order
+  // the agents are looked up in agentGrid, so call this after findNeighbors and before anything moves or kills them
+  // a sphere that covers more cells than there are agents (the culls are mostly bigger than the world) checks every agent instead
+  template <class F>
+  void forEachAgentWithin(Vec3f center, float radius, F f) {
+    float radius2 = radius * radius;
+    inRange.clear();
+    if (agentGrid.cellsInRange(center, radius) > agents.alive.size()) {
+      //one branch-free pass over the position arrays, dead slots drop out through the mask
+      inRangeMask.resize(agents.size);
+      const float *x = agents.px.data(), *y = agents.py.data(), *z = agents.pz.data();
+      const uint8_t* dead = agents.isDead.data();
+      uint8_t* mask = inRangeMask.data();
+      parallelFor(agents.size, 16384, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+          float dx = x[i] - center.x, dy = y[i] - center.y, dz = z[i] - center.z;
+          mask[i] = (dx * dx + dy * dy + dz * dz < radius2) & (dead[i] == 0);
+        }
+      });
+      for (int i = 0; i < agents.size; i++) { if (mask[i]) { inRange.push_back(i); } }
+    } else {
+      agentGrid.forEachInRange(center, radius, rangeCells, [&](int id, const Vec3f&) {
+        if (!agents.isDead[id] && (agents.position(id) - center).magSqr() < radius2) { inRange.push_back(id); }
+      });
+      sort(inRange.begin(), inRange.end());
+    }
+    for (int i : inRange) { f(i); }
+  }
+
+  //flocking
+  void calcFlocking() { // calculate the average heading, center, and flockCount for each agent
+    auto countAndAge = [&](int i) {
+      agents.incrementLifespan(i, -1 * params.decreaseLifespanAmount); //every loop iteration, decrease the lifespan a bit
+      agents.flockCount[i] = neighbors.count(i);
+    };
+    if (flockingMode == FLOCK_SIMD) { // the kernel's heading and center, copied block by block as they come out
+      FlockingKernel& f = flockingKernel;
+      f.flock(agents, neighbors, [&](int b) {
+        int end = min((b + 1) * FlockingKernel::LANES, (int)agents.alive.size());
+        for (int k = b * FlockingKernel::LANES; k < end; k++) {
+          int i = agents.alive[k];
+          countAndAge(i);
+          agents.hx[i] = f.hx[k]; agents.hy[i] = f.hy[k]; agents.hz[i] = f.hz[k];
+          agents.cx[i] = f.cx[k]; agents.cy[i] = f.cy[k]; agents.cz[i] = f.cz[k];
+        }
+      });
+      return;
+    }
+    if (flockingMode == FLOCK_VALIDATE) { flockingKernel.flock(agents, neighbors); }
+    //every agent only writes its own attributes and only reads its neighbors' position and forward -> agents in parallel
+    parallelFor(agents.alive.size(), 1024, [&](int begin, int end) {
+      for (int k = begin; k < end; k++) {
+        int i = agents.alive[k];
+        countAndAge(i);
+        int results = agents.flockCount[i];
+        //the scalar reference
+        Vec3f avgHeading(0, 0, 0);
+        Vec3f centerPos(0, 0, 0);
+
+        for (int j = 0; j < results; j++) {
+          int id = neighbors.neighbor(i, j);
+          if (agents.isDead[id]) { continue; } // only look at the neighbors that are alive!
+          avgHeading.x += agents.fx[id] + agents.rx[id];
+          avgHeading.y += agents.fy[id] + agents.ry[id];
+          avgHeading.z += agents.fz[id] + agents.rz[id];
+          centerPos.x += agents.px[id];
+          centerPos.y += agents.py[id];
+          centerPos.z += agents.pz[id];
+        }
+        if (results > 0) {
+          avgHeading = avgHeading.normalize() / results;
+          centerPos = centerPos.normalize() / results;
+        }
+        agents.hx[i] = avgHeading.x; agents.hy[i] = avgHeading.y; agents.hz[i] = avgHeading.z;
+        agents.cx[i] = centerPos.x; agents.cy[i] = centerPos.y; agents.cz[i] = centerPos.z;
+      }
+    });
+    if (flockingMode == FLOCK_VALIDATE) {
+      const FlockingKernel& f = flockingKernel;
+      validateFlocking({{&f.hx, &agents.hx}, {&f.hy, &agents.hy}, {&f.hz, &agents.hz}, {&f.cx, &agents.cx}, {&f.cy, &agents.cy}, {&f.cz, &agents.cz}});
+    }
+  }
+
+  void alignmentAndCohesion() { //agent update function
+    if (flockingMode == FLOCK_SIMD) { // the kernel's moves, copied block by block as they come out
+      FlockingKernel& f = flockingKernel;
+      f.move(agents, params.rate, [&](int b) {
+        int end = min((b + 1) * FlockingKernel::LANES, (int)agents.alive.size());
+        for (int k = b * FlockingKernel::LANES; k < end; k++) {
+          int i = agents.alive[k];
+          agents.px[i] = f.px[k]; agents.py[i] = f.py[k]; agents.pz[i] = f.pz[k];
+          agents.fx[i] = f.fx[k]; agents.fy[i] = f.fy[k]; agents.fz[i] = f.fz[k];
+          agents.ux[i] = f.ux[k]; agents.uy[i] = f.uy[k]; agents.uz[i] = f.uz[k];
+          agents.cx[i] = f.cx[k]; agents.cy[i] = f.cy[k]; agents.cz[i] = f.cz[k];
+        }
+      });
+      return;
+    }
+    if (flockingMode == FLOCK_VALIDATE) { flockingKernel.move(agents, params.rate); }
+    //alignment and cohesion from boids algorithm, every agent on its own -> in parallel
+    parallelFor(agents.alive.size(), 1024, [&](int begin, int end) {
+      for (int k = begin; k < end; k++) {
+        int i = agents.alive[k];
+        //the scalar reference
+        Vec3f center = agents.center(i).normalize();
+        agents.cx[i] = center.x; agents.cy[i] = center.y; agents.cz[i] = center.z;
+        Vec3f forward = agents.forward(i);
+        Vec3f position = agents.position(i);
+        position.lerp(center + forward, agents.moveRate(i).mag() * params.rate);
+        agents.setPosition(i, position);
+        agents.faceToward(i, (agents.heading(i) + center + forward).normalize() * agents.turnRate(i).mag()); // point agents in the direction of their heading
+      }
+    });
+    if (flockingMode == FLOCK_VALIDATE) {
+      const FlockingKernel& f = flockingKernel;
+      validateFlocking({{&f.px, &agents.px}, {&f.py, &agents.py}, {&f.pz, &agents.pz}, {&f.fx, &agents.fx}, {&f.fy, &agents.fy},
+                        {&f.fz, &agents.fz}, {&f.ux, &agents.ux}, {&f.uy, &agents.uy}, {&f.uz, &agents.uz}, {&f.cx, &agents.cx},
+                        {&f.cy, &agents.cy}, {&f.cz, &agents.cz}});
+    }
+  }
+
+  // FLOCK_VALIDATE: the kernel's results (indexed like alive) against the scalar ones (in the store) -> the run goes on with the scalar ones
+  void validateFlocking(initializer_list<pair<const vector<float>*, const vector<float>*>> arrays) {
+    for (auto& kernelAndScalar : arrays) {
+      const vector<float>& kernel = *kernelAndScalar.first;
+      const vector<float>& scalar = *kernelAndScalar.second;
+      flockingError = parallelReduce(agents.alive.size(), 16384, flockingError, [&](int begin, int end) {
+        float error = 0;
+        for (int k = begin; k < end; k++) { error = max(error, fabs(kernel[k] - scalar[agents.alive[k]])); }
+        return error;
+      }, [](float a, float b) { return max(a, b); });
+    }
+  }
+
+  void sortAgents() { // now and then, put the agents that are close in space close in memory
+    if (params.sortInterval <= 0 || counter % params.sortInterval != 0) { return; }
+    agents.sortByMorton();
+  }
+
+  // how far an agent looks for neighbors -> localRadius is a fraction of half the world's width (the reach it had with HashSpace)
+  float neighborRadius() const { return params.localRadius * 0.5f; }
+
+  void findNeighbors() { // grid the live agents, then find everyone's neighbors in one parallel pass
+    auto positionOf = [&](int i) { return agents.position(i); };
+    agentGrid.build(agents.alive.size(), neighborRadius(), [&](int k) { return agents.alive[k]; }, positionOf);
+    neighbors.build(agentGrid, agents.size, agents.alive, params.k, neighborRadius(), positionOf);
+  }
+
+  //***********************************************************************
+  // checksum of the whole simulation state -> two runs with the same seed have to end with the same hash
+
+  uint64_t stateHash() {
+    uint64_t hash = 14695981039346656037ull; // FNV-1a
+    auto add = [&](const void* data, size_t bytes) {
+      const unsigned char* p = (const unsigned char*)data;
+      for (size_t i = 0; i < bytes; i++) { hash = (hash ^ p[i]) * 1099511628211ull; }
+    };
+    add(agents.px.data(), agents.size * sizeof(float));
+    add(agents.py.data(), agents.size * sizeof(float));
+    add(agents.pz.data(), agents.size * sizeof(float));
+    add(agents.lifespan.data(), agents.size * sizeof(float));
+    add(agents.fitnessValue.data(), agents.size * sizeof(float));
+    add(agents.isDead.data(), agents.size * sizeof(uint8_t));
+    for (int i = 0; i < field.getAmountOfFood(); i++) {
+      add(&field.food[i].position, sizeof(Vec3f));
+    }
+    add(&aliveAgents, sizeof(int));
+    return hash;
+  }
+};
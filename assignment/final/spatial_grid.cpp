@@ -0,0 +1,323 @@
+/* spatial_grid.cpp
+ * This file describes a uniform grid for "what is near this point?" lookups (the agents' neighbors, the food near an agent)
+ * Space is cut into cubes of cellSize, in one of two modes:
+ *   DENSE  -> a box of cells from -worldSize to worldSize, anything outside the box is kept in the nearest edge cell
+ *   HASHED -> the cells are hashed into a table, so the points can be anywhere (the food drifts off forever)
+ * build() sorts the items into the cells with a parallel counting sort (parallel.cpp) -> O(n), and the same order every time
+ * forEachNear() visits every item in the 27 cells around a point, so with cellSize >= the search radius nothing in range is missed
+ * (it also visits some items that are further away, and items whose cells collide in the table -> always check the distance)
+ * forEachInRange() visits the items in every cell a sphere of any radius touches (area of effect lookups, like the culls)
+ * NeighborQuery is the k-nearest-within-a-radius search on top of it (the same thing HashSpace::Query did)
+ * NeighborTable runs that search for a whole batch of items at once, in parallel, and keeps the answers in one flat (CSR) array
+ */
+
+#pragma once
+
+//allolib includes
+#include "al/math/al_Vec.hpp"
+//c std library includes
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+//my includes
+#include "../common/parallel.cpp"
+
+using namespace al;
+using namespace std;
+
+struct SpatialGrid {
+  enum Mode { DENSE, HASHED };
+  Mode mode = HASHED;
+  float worldSize = 1; // DENSE only: the box goes from -worldSize to worldSize on every axis
+
+  float cellSize = 1;
+  int cellsPerSide = 1; // DENSE only
+  unsigned cellCount = 0; // DENSE: cellsPerSide^3, HASHED: the table size (a power of two)
+  vector<int> cellStart; // items of cell c are items[cellStart[c] .. cellStart[c + 1]]
+  vector<int> items; // item ids, sorted by cell (and by id inside a cell)
+  vector<Vec3f> itemPosition; // the position of items[k], kept next to it for the distance checks
+
+  vector<unsigned> itemCell; // scratch for the sort: the cell of every item, in build order
+  unique_ptr<atomic<int>[]> cursor; // scratch for the sort: how full every cell is
+  unsigned cursorSize = 0;
+
+  int coordinate(float v) const { // clamped before the cast -> a NaN or a point that drifted far away can't overflow the int
+    float c = floor(v / cellSize);
+    float limit = mode == DENSE ? cellsPerSide / 2 + 1 : 1 << 30; // DENSE: one past the box's edge cells (clamped to them anyway)
+    if (!(c > -limit)) { return -(int)limit; } // NaN lands here too
+    if (c > limit) { return (int)limit; }
+    return (int)c;
+  }
+  int clampCoordinate(int c) const { return min(max(c, 0), cellsPerSide - 1); }
+
+  unsigned cellOf(int x, int y, int z) const { // x, y, z are cell coordinates (position / cellSize)
+    if (mode == HASHED) {
+      return ((unsigned)x * 73856093u ^ (unsigned)y * 19349663u ^ (unsigned)z * 83492791u) & (cellCount - 1);
+    }
+    int offset = cellsPerSide / 2; // coordinate 0 starts at the center of the box
+    return (clampCoordinate(z + offset) * cellsPerSide + clampCoordinate(y + offset)) * cellsPerSide + clampCoordinate(x + offset);
+  }
+
+  void layout(int n, float size) { // pick the cell size and the number of cells for n items
+    cellSize = max(size, 1e-4f); // tiny cells would overflow the cell coordinates
+    if (mode == HASHED) {
+      cellCount = 1;
+      while (cellCount < 2 * (unsigned)n) { cellCount <<= 1; }
+      return;
+    }
+    //keep the box to at most a few cells per item -> bigger cells only make the search visit more items, never miss any
+    unsigned maxCells = max(4096u, 4 * (unsigned)n);
+    while (true) {
+      cellsPerSide = 2 * ((int)ceil(worldSize / cellSize) + 1); // even, so the box is centered on a cell corner
+      if ((unsigned)cellsPerSide * cellsPerSide * cellsPerSide <= maxCells) { break; }
+      cellSize *= 1.25f;
+    }
+    cellCount = cellsPerSide * cellsPerSide * cellsPerSide;
+  }
+
+  // idOf(i) gives the id of the i'th item (what forEachNear hands back), positionOf(id) its position
+  template <class IdOf, class PositionOf>
+  void build(int n, float size, IdOf idOf, PositionOf positionOf) {
+    layout(n, size);
+    if (cursorSize < cellCount) {
+      cursor.reset(new atomic<int>[cellCount]);
+      cursorSize = cellCount;
+    }
+    cellStart.resize(cellCount + 1);
+    items.resize(n);
+    itemPosition.resize(n);
+    itemCell.resize(n);
+    const int grain = 16384;
+
+    //count the items in every cell
+    parallelFor(cellCount, grain, [&](int begin, int end) {
+      for (int c = begin; c < end; c++) { cursor[c].store(0, memory_order_relaxed); }
+    });
+    parallelFor(n, grain, [&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        Vec3f p = positionOf(idOf(i));
+        unsigned c = cellOf(coordinate(p.x), coordinate(p.y), coordinate(p.z));
+        itemCell[i] = c;
+        cursor[c].fetch_add(1, memory_order_relaxed);
+      }
+    });
+
+    //counts -> where every cell starts (a prefix sum per range, then the ranges are offset by the ones before them)
+    int ranges = min(parallelThreads(), (int)(cellCount + grain - 1) / grain);
+    ranges = max(ranges, 1);
+    vector<int> rangeTotal(ranges + 1, 0);
+    auto rangeBegin = [&](int r) { return (int)((long long)cellCount * r / ranges); };
+    parallelFor(ranges, 1, [&](int begin, int end) {
+      for (int r = begin; r < end; r++) {
+        int sum = 0;
+        for (int c = rangeBegin(r); c < rangeBegin(r + 1); c++) {
+          cellStart[c] = sum;
+          sum += cursor[c].load(memory_order_relaxed);
+        }
+        rangeTotal[r + 1] = sum;
+      }
+    });
+    for (int r = 0; r < ranges; r++) { rangeTotal[r + 1] += rangeTotal[r]; }
+    parallelFor(ranges, 1, [&](int begin, int end) {
+      for (int r = begin; r < end; r++) {
+        for (int c = rangeBegin(r); c < rangeBegin(r + 1); c++) {
+          cellStart[c] += rangeTotal[r];
+          cursor[c].store(cellStart[c], memory_order_relaxed);
+        }
+      }
+    });
+    cellStart[cellCount] = n;
+
+    //drop every item into its cell
+    parallelFor(n, grain, [&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        items[cursor[itemCell[i]].fetch_add(1, memory_order_relaxed)] = idOf(i);
+      }
+    });
+
+    //the threads filled the cells in any order -> sort every cell by id, so a build always comes out the same
+    parallelFor(cellCount, grain, [&](int begin, int end) {
+      for (int c = begin; c < end; c++) {
+        int first = cellStart[c], last = cellStart[c + 1];
+        for (int k = first + 1; k < last; k++) { // cells hold a handful of items, insertion sort it is
+          int id = items[k];
+          int m = k;
+          while (m > first && items[m - 1] > id) { items[m] = items[m - 1]; m--; }
+          items[m] = id;
+        }
+        for (int k = first; k < last; k++) { itemPosition[k] = positionOf(items[k]); }
+      }
+    });
+  }
+
+  // f(id, position) is called with every item near p, return true from it to stop looking
+  template <class F>
+  void forEachNear(Vec3f p, F f) const {
+    if (items.empty()) { return; }
+    int x = coordinate(p.x), y = coordinate(p.y), z = coordinate(p.z);
+    unsigned visited[27];
+    int visitedCount = 0;
+    for (int dz = -1; dz <= 1; dz++) {
+      for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+          unsigned c = cellOf(x + dx, y + dy, z + dz);
+          // two neighbor cells can be the same cell (hash collisions, or clamped to the edge of the box), only look at it once
+          bool seen = false;
+          for (int v = 0; v < visitedCount; v++) { if (visited[v] == c) { seen = true; break; } }
+          if (seen) { continue; }
+          visited[visitedCount++] = c;
+          for (int k = cellStart[c]; k < cellStart[c + 1]; k++) {
+            if (f(items[k], itemPosition[k])) { return; }
+          }
+        }
+      }
+    }
+  }
+
+  // how many cells forEachInRange(p, radius) would look at -> when it is more than there are items, just check every item instead
+  double cellsInRange(Vec3f p, float radius) const {
+    double cells = 1;
+    for (int a = 0; a < 3; a++) {
+      int low = coordinate(p[a] - radius), high = coordinate(p[a] + radius);
+      if (mode == DENSE) { // the box is clamped, the cells past its edge are the edge cells
+        int offset = cellsPerSide / 2;
+        low = clampCoordinate(low + offset); high = clampCoordinate(high + offset);
+      }
+      cells *= (double)high - low + 1;
+    }
+    return cells;
+  }
+
+  // f(id, position) is called once with every item in the cells the sphere around p touches (check the distance, some are further away)
+  // cells is scratch, pass the same vector every time so it doesn't allocate
+  template <class F>
+  void forEachInRange(Vec3f p, float radius, vector<unsigned>& cells, F f) const {
+    cells.clear();
+    if (items.empty()) { return; }
+    int low[3], high[3];
+    for (int a = 0; a < 3; a++) { low[a] = coordinate(p[a] - radius); high[a] = coordinate(p[a] + radius); }
+    if (mode == DENSE) { // the cells past the edge of the box are the edge cells (they hold everything outside it)
+      int offset = cellsPerSide / 2;
+      for (int a = 0; a < 3; a++) {
+        low[a] = clampCoordinate(low[a] + offset) - offset; high[a] = clampCoordinate(high[a] + offset) - offset;
+      }
+    }
+    for (int z = low[2]; z <= high[2]; z++) {
+      for (int y = low[1]; y <= high[1]; y++) {
+        for (int x = low[0]; x <= high[0]; x++) { cells.push_back(cellOf(x, y, z)); }
+      }
+    }
+    // clamped and hashed cells can come up more than once, only look at each once (in cell order -> the same order every time)
+    sort(cells.begin(), cells.end());
+    cells.erase(unique(cells.begin(), cells.end()), cells.end());
+    for (unsigned c : cells) {
+      for (int k = cellStart[c]; k < cellStart[c + 1]; k++) { f(items[k], itemPosition[k]); }
+    }
+  }
+};
+
+// the k nearest items within radius of a point, nearest first -> make one per loop and reuse it, it doesn't allocate after that
+// the grid has to be built with a cellSize of at least the radius
+// equally far items are ordered by id, so the answer doesn't depend on the order the items were offered in
+struct NeighborQuery {
+  int k;
+  vector<int> ids;
+  vector<float> distances; // squared
+  int count = 0;
+
+  NeighborQuery(int maxResults) : k(max(maxResults, 0)), ids(k), distances(k) {}
+
+  int operator()(const SpatialGrid& grid, Vec3f p, float radius) {
+    clear();
+    if (k <= 0) { return 0; }
+    float radius2 = radius * radius;
+    grid.forEachNear(p, [&](int id, const Vec3f& position) {
+      float d = (position - p).magSqr();
+      if (d <= radius2) { offer(id, d); }
+      return false;
+    });
+    return count;
+  }
+
+  void clear() { count = 0; }
+
+  bool before(float d, int id, int m) const { return d < distances[m] || (d == distances[m] && id < ids[m]); }
+
+  void offer(int id, float d) { // keep id if it is one of the k nearest so far (d is its squared distance)
+    if (k <= 0 || (count == k && !before(d, id, k - 1))) { return; } // further than the k we have
+    int m = count < k ? count++ : k - 1; // insert it in order, dropping the furthest if we are full
+    while (m > 0 && before(d, id, m - 1)) {
+      ids[m] = ids[m - 1];
+      distances[m] = distances[m - 1];
+      m--;
+    }
+    ids[m] = id;
+    distances[m] = d;
+  }
+
+  int operator[](int i) const { return ids[i]; }
+};
+
+// everyone's neighbors, found once and read by everything that needs them
+// the neighbors of item i are ids[start[i] .. start[i + 1]] (nearest first for build), with their squared distances next to them
+// items that weren't in the batch just have no neighbors
+struct NeighborTable {
+  vector<int> start; // one more than the number of items
+  vector<int> ids;
+  vector<float> distances;
+
+  vector<int> found; // scratch: k answers per item
+  vector<float> foundDistances;
+  vector<int> foundCount;
+
+  int count(int i) const { return start[i + 1] - start[i]; }
+  int neighbor(int i, int j) const { return ids[start[i] + j]; }
+  float distance(int i, int j) const { return distances[start[i] + j]; }
+
+  // the k nearest within radius on the grid -> items is the batch to search for (ids below size), positionOf(id) their position
+  template <class PositionOf>
+  void build(const SpatialGrid& grid, int size, const vector<int>& items, int k, float radius, PositionOf positionOf) {
+    build(size, items, k, [&](int i, NeighborQuery& query) { query(grid, positionOf(i), radius); });
+  }
+
+  // the same, but search(i, query) does the search for item i (feed query with clear() and offer())
+  template <class Search>
+  void build(int size, const vector<int>& items, int k, Search search) {
+    k = max(k, 0);
+    found.resize((size_t)size * k);
+    foundDistances.resize((size_t)size * k);
+    foundCount.assign(size, 0);
+    const int grain = 1024;
+
+    parallelFor(items.size(), grain, [&](int begin, int end) {
+      NeighborQuery query(k); // one per thread
+      for (int m = begin; m < end; m++) {
+        int i = items[m];
+        search(i, query);
+        for (int j = 0; j < query.count; j++) {
+          found[(size_t)i * k + j] = query.ids[j];
+          foundDistances[(size_t)i * k + j] = query.distances[j];
+        }
+        foundCount[i] = query.count;
+      }
+    });
+
+    start.resize(size + 1);
+    start[0] = 0;
+    for (int i = 0; i < size; i++) { start[i + 1] = start[i] + foundCount[i]; }
+    ids.resize(start[size]);
+    distances.resize(start[size]);
+    parallelFor(items.size(), grain, [&](int begin, int end) {
+      for (int m = begin; m < end; m++) {
+        int i = items[m];
+        for (int j = 0; j < foundCount[i]; j++) {
+          ids[start[i] + j] = found[(size_t)i * k + j];
+          distances[start[i] + j] = foundDistances[(size_t)i * k + j];
+        }
+      }
+    });
+  }
+};
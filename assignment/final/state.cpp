@@ -4,21 +4,43 @@
 
 #pragma once 
 
-#include "al/app/al_DistributedApp.hpp"
+#include "al/spatial/al_Pose.hpp"
 #include "agent.cpp"
 #include "field.cpp"
 
 using namespace al;
 
-const int MAX_AGENT_NUM = 500;
-const int MAX_FOOD_NUM = 500;
+// the most agents and food one frame of the shared state can carry to the renderers
+// the simulation itself is sized at startup (SimulationConfig in simulation.cpp), these only bound what gets sent
+// Cuttlebone sends the state as one fixed size block, so they have to be known at compile time -> build with -DMAX_AGENT_NUM=... to raise them
+#ifndef MAX_AGENT_NUM
+#define MAX_AGENT_NUM 500
+#endif
+#ifndef MAX_FOOD_NUM
+#define MAX_FOOD_NUM 500
+#endif
 
 // Only share the state that needs to be shared for sending
 // Everything that is simulated
 struct SharedState {
     Pose cameraPose; //where our camera is in space
+    int agentCount = 0; //how many of dAgents are filled in this frame
+    int foodCount = 0; //how many of dFood are filled in this frame
     DrawableAgent dAgents[MAX_AGENT_NUM]; //visualize the agents
     DrawableFood dFood[MAX_FOOD_NUM]; //visualize the food
     float background; //of the window
     float size, ratio; //of agents
-};
\ No newline at end of file
+};
+// what the simulation thread hands the render thread after every step (final.cpp passes these through a TripleBuffer)
+// -> the part of the SharedState that comes from the simulation, plus what the gui and the cull mesh show
+struct SimulationFrame {
+    int agentCount = 0;
+    int foodCount = 0;
+    DrawableAgent dAgents[MAX_AGENT_NUM];
+    DrawableFood dFood[MAX_FOOD_NUM];
+    int aliveAgents = 0;
+    bool culled = false; //a cull happened during this step
+    Vec3f cullPosition;
+    float cullRadius = 0;
+    Color cullColor;
+};
@@ -0,0 +1,152 @@
+/* trace.cpp
+ * Scoped tracing zones -> TRACE_SCOPE("name") records when the enclosing scope started and how long it took
+ * Every thread records into its own ring buffer (the newest events overwrite the oldest), so recording never takes a lock
+ * (only a thread's very first event does, to register its buffer)
+ * Every slot of the ring is a little seqlock, so the buffers can be dumped while their threads keep recording
+ * Tracer::instance().writeChromeTrace("trace.json") dumps the buffers as chrome://tracing json (ui.perfetto.dev opens it too)
+ * Build with -DNO_TRACING to compile all the zones out
+ */
+
+#pragma once
+
+//c std library includes
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct TraceEvent {
+  const char* name; // zone names are string literals, so only the pointer is stored
+  int64_t start; // ns since the tracer was created
+  int64_t duration; // ns
+};
+
+struct TraceSlot { // one event in the ring -> the fields are atomic so a reader on another thread can look at them
+  atomic<uint64_t> sequence{0}; // 2n + 1 while the n-th event is being written here, 2n + 2 once it is done
+  atomic<const char*> name{nullptr};
+  atomic<int64_t> start{0};
+  atomic<int64_t> duration{0};
+};
+
+struct TraceBuffer { // one per thread, only that thread writes to it
+  vector<TraceSlot> events; // ring buffer, size is a power of two
+  atomic<uint64_t> written{0}; // how many events were ever recorded
+  int threadId;
+  string threadName;
+
+  TraceBuffer(int id, size_t size) : events(size), threadId(id), threadName("thread " + to_string(id)) {}
+
+  void record(const char* name, int64_t start, int64_t duration) {
+    uint64_t w = written.load(memory_order_relaxed);
+    TraceSlot& e = events[w & (events.size() - 1)];
+    e.sequence.store(2 * w + 1, memory_order_relaxed);
+    // release -> a reader that sees any of the new fields also sees the odd sequence (free on x86, and no fence, which TSan can't follow)
+    e.name.store(name, memory_order_release);
+    e.start.store(start, memory_order_release);
+    e.duration.store(duration, memory_order_release);
+    e.sequence.store(2 * w + 2, memory_order_release);
+    written.store(w + 1, memory_order_release);
+  }
+
+  bool read(uint64_t n, TraceEvent& out) const { // the n-th event, false if it is being written or was overwritten
+    const TraceSlot& e = events[n & (events.size() - 1)];
+    uint64_t before = e.sequence.load(memory_order_acquire);
+    if (before != 2 * n + 2) { return false; }
+    out.name = e.name.load(memory_order_acquire); // acquire -> the sequence is checked again only after the fields were read
+    out.start = e.start.load(memory_order_acquire);
+    out.duration = e.duration.load(memory_order_acquire);
+    return e.sequence.load(memory_order_relaxed) == before;
+  }
+};
+
+struct Tracer {
+  static Tracer& instance() {
+    static Tracer tracer;
+    return tracer;
+  }
+
+  atomic<bool> enabled{true};
+  size_t bufferSize = 1 << 16; // events per thread -> must be a power of two, only used for buffers created after it is set
+
+  int64_t now() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch).count();
+  }
+
+  TraceBuffer& threadBuffer() { // the calling thread's buffer, created on first use
+    thread_local TraceBuffer* buffer = nullptr;
+    if (buffer == nullptr) {
+      lock_guard<mutex> lock(buffersLock);
+      buffers.emplace_back(new TraceBuffer(buffers.size(), bufferSize));
+      buffer = buffers.back().get();
+    }
+    return *buffer;
+  }
+
+  void setThreadName(const char* name) { // shows up as the track name in chrome://tracing
+    TraceBuffer& buffer = threadBuffer();
+    if (buffer.threadName == name) { return; }
+    lock_guard<mutex> lock(buffersLock);
+    buffer.threadName = name;
+  }
+
+  bool writeChromeTrace(const string& path) { // can be called from any thread while the others keep recording
+    ofstream file(path);
+    if (!file.good()) { return false; }
+    file << "{\"traceEvents\":[\n";
+    bool first = true;
+    lock_guard<mutex> lock(buffersLock);
+    for (auto& buffer : buffers) {
+      file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->threadId
+           << ",\"args\":{\"name\":\"" << buffer->threadName << "\"}}";
+      first = false;
+
+      uint64_t size = buffer->events.size();
+      uint64_t end = buffer->written.load(memory_order_acquire);
+      uint64_t begin = end > size ? end - size : 0;
+      for (uint64_t i = begin; i < end; i++) {
+        TraceEvent e;
+        if (!buffer->read(i, e)) { continue; } // the owning thread overwrote it while we were writing the file
+        file << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->threadId
+             << ",\"ts\":" << e.start / 1000.0 << ",\"dur\":" << e.duration / 1000.0 << "}";
+      }
+    }
+    file << "\n]}\n";
+    return file.good();
+  }
+
+ private:
+  Tracer() : epoch(chrono::steady_clock::now()) {}
+
+  chrono::steady_clock::time_point epoch;
+  mutex buffersLock; // guards the buffers list and the thread names, never taken while recording
+  vector<unique_ptr<TraceBuffer>> buffers; // never freed, a thread's events outlive the thread
+};
+
+struct TraceZone { // records one event when it goes out of scope
+  const char* name;
+  int64_t start;
+
+  TraceZone(const char* n) : name(n), start(Tracer::instance().now()) {}
+  ~TraceZone() {
+    Tracer& tracer = Tracer::instance();
+    if (tracer.enabled.load(memory_order_relaxed)) {
+      tracer.threadBuffer().record(name, start, tracer.now() - start);
+    }
+  }
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#ifdef NO_TRACING
+#define TRACE_SCOPE(name)
+#define TRACE_THREAD_NAME(name)
+#else
+#define TRACE_SCOPE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) Tracer::instance().setThreadName(name)
+#endif
@@ -0,0 +1,38 @@
+/* triple_buffer.cpp
+ * This file describes TripleBuffer, how one thread hands whole frames to another without either of them waiting
+ * Three copies of T: the writer fills the back one, the reader uses the front one, the middle one is the last finished frame
+ * publish() swaps back and middle, update() swaps middle and front if a new frame came in since -> both swaps are one atomic exchange
+ * The reader always gets the newest finished frame (frames it was too slow for are skipped), the writer never waits for the reader
+ * Only one thread may write and only one may read
+ */
+
+#pragma once
+
+//c std library includes
+#include <atomic>
+#include <memory>
+
+using namespace std;
+
+template <class T>
+struct TripleBuffer {
+  unique_ptr<T[]> buffers{new T[3]}; // on the heap, a frame can be big (the SharedState is)
+  atomic<int> middle{1}; // the index of the middle buffer, | FRESH if the reader hasn't taken it yet
+  int back = 0; // the writer's
+  int front = 2; // the reader's
+  static const int FRESH = 4;
+
+  //writer
+  T& writeBuffer() { return buffers[back]; }
+  void publish() { // writeBuffer() is finished -> it becomes the newest frame, and the writer gets a buffer the reader isn't using
+    back = middle.exchange(back | FRESH, memory_order_acq_rel) & 3;
+  }
+
+  //reader
+  bool update() { // take the newest finished frame into readBuffer(), false if nothing was published since the last update
+    if (!(middle.load(memory_order_relaxed) & FRESH)) { return false; }
+    front = middle.exchange(front, memory_order_acq_rel) & 3;
+    return true;
+  }
+  const T& readBuffer() const { return buffers[front]; }
+};
@@ -8,6 +8,8 @@ using namespace al;
 #include <vector>
 using namespace std;
 
+#include "common/parallel.cpp"
+
 int partNum = 1000;
 
 Vec3f rv(float scale) {
@@ -102,20 +104,36 @@ struct AlloApp : App {
     // *********** Calculate forces ***********
 
     // gravity
-    for (int i = 0; i < partNum; i++) { //nested for loops (for each particle, calculate force with all other particles but itself one at a time)
-      for (int j = 1+i; j < partNum; j++) {
-          Vec3f distance(mesh.vertices()[j] - mesh.vertices()[i]); //calculate distances between particles
-          Vec3f gravityVal = gravConst * mass[i] * mass[j] * distance.normalize() / pow(distance.mag(), 2); // F = G * m1 * m2 / r^2
-          //cout << gravityVal << endl;
-          // if (gravityVal.mag() > gravityBound) {
-          //   gravityVal.normalize(gravityVal.mag()/10);
-          // }
-          // if (gravityVal.mag() < -gravityBound) {
-          //   gravityVal.normalize(-gravityVal.mag()/10);
-          // }
-          acceleration[i] += gravityVal/mass[i];
-          acceleration[j] -= gravityVal/mass[j];
+    auto gravity = [&](int i, int j) -> Vec3f { // pull of particle j on particle i
+      Vec3f distance(mesh.vertices()[j] - mesh.vertices()[i]); //calculate distances between particles
+      Vec3f gravityVal = gravConst * mass[i] * mass[j] * distance.normalize() / pow(distance.mag(), 2); // F = G * m1 * m2 / r^2
+      //cout << gravityVal << endl;
+      // if (gravityVal.mag() > gravityBound) {
+      //   gravityVal.normalize(gravityVal.mag()/10);
+      // }
+      // if (gravityVal.mag() < -gravityBound) {
+      //   gravityVal.normalize(-gravityVal.mag()/10);
+      // }
+      return gravityVal;
+    };
+    if (parallelThreads() == 1) {
+      for (int i = 0; i < partNum; i++) { //nested for loops (for each particle, calculate force with all other particles but itself one at a time)
+        for (int j = 1+i; j < partNum; j++) {
+            Vec3f gravityVal = gravity(i, j);
+            acceleration[i] += gravityVal/mass[i];
+            acceleration[j] -= gravityVal/mass[j];
+        }
       }
+    } else {
+      // with more cores, each thread takes a block of particles and only writes their own accelerations:
+      // a pair is worked out twice (once from each side) but the blocks run at the same time
+      parallelFor(partNum, 64, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+          for (int j = 0; j < partNum; j++) {
+            if (j != i) { acceleration[i] += gravity(i, j)/mass[i]; }
+          }
+        }
+      });
     }
 
     
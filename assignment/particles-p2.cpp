@@ -8,6 +8,8 @@ using namespace al;
 #include <vector>
 using namespace std;
 
+#include "common/parallel.cpp"
+
 int partNum = 1000;
 
 Vec3f rv(float scale) {
@@ -105,15 +107,29 @@ struct AlloApp : App {
 
     // gravity
     float G = 6.674e-4; //gravitational constant
-    for (int i = 0; i < partNum; i++) { //nested for loops (for each particle, calculate force with all other particles but itself one at a time)
-      for (int j = 1+i; j < partNum; j++) {
-          Vec3f distance(mesh.vertices()[j] - mesh.vertices()[i]); //calculate distances between particles -> b-a = c
-          Vec3f gravityVal = G * mass[i] * mass[j] * distance.normalize() / pow(distance.mag(), 2); // F = G * m1 * m2 / r^2
-          //multiply by r hat -> only direction, normalized magnitude
-
-          acceleration[i] += gravityVal/mass[i];
-          acceleration[j] -= gravityVal/mass[j];
+    auto gravity = [&](int i, int j) -> Vec3f { // force of particle j on particle i
+      Vec3f distance(mesh.vertices()[j] - mesh.vertices()[i]); //calculate distances between particles -> b-a = c
+      //multiply by r hat -> only direction, normalized magnitude
+      return G * mass[i] * mass[j] * distance.normalize() / pow(distance.mag(), 2); // F = G * m1 * m2 / r^2
+    };
+    if (parallelThreads() == 1) {
+      for (int i = 0; i < partNum; i++) { //nested for loops (for each particle, calculate force with all other particles but itself one at a time)
+        for (int j = 1+i; j < partNum; j++) {
+            Vec3f gravityVal = gravity(i, j);
+            acceleration[i] += gravityVal/mass[i];
+            acceleration[j] -= gravityVal/mass[j];
+        }
       }
+    } else {
+      // split the particles between the threads, every particle adds up all of its own forces
+      // (the same pair gets computed by both particles, so no two threads ever touch one acceleration)
+      parallelFor(partNum, 64, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+          for (int j = 0; j < partNum; j++) {
+            if (j != i) { acceleration[i] += gravity(i, j)/mass[i]; }
+          }
+        }
+      });
     }
 
     //limit acceleration
@@ -8,6 +8,8 @@ using namespace al;
 #include <vector>
 using namespace std;
 
+#include "common/parallel.cpp"
+
 int partNum = 1000;
 
 Vec3f rv(float scale) {
@@ -102,21 +104,42 @@ struct AlloApp : App {
     // *********** Calculate forces ***********
 
     // gravity
-    for (int i = 0; i < partNum; i++) { //nested for loops (for each particle, calculate force with all other particles but itself one at a time)
-        for (int j = 1+i; j < partNum; j++) {
+    auto gravity = [&](int i, int j) -> Vec3f { // pull of particle j on particle i
+      Vec3f distance(mesh.vertices()[j] - mesh.vertices()[i]); //calculate distances between particles
+      return gravConst * mass[i] * mass[j] * distance.normalize() / pow(distance.mag(), 2); // F = G * m1 * m2 / r^2
+    };
+    if (parallelThreads() == 1) {
+      for (int i = 0; i < partNum; i++) { //nested for loops (for each particle, calculate force with all other particles but itself one at a time)
+          for (int j = 1+i; j < partNum; j++) {
+
+              rnd::Random<> rng;
+              auto rv = [&](float scale) -> Vec3f {
+              return Vec3f(rng.uniformS(), rng.uniformS(), rng.uniformS()) * scale;
+              };
+
+              Vec3f gravityVal = gravity(i, j);
 
-            rnd::Random<> rng;
+              //using a random multiplier here in order to show a more naturalistic, "swimming" motion of the particles
+              acceleration[i] += gravityVal * rv(scaleVal)/mass[i];
+              acceleration[j] -= gravityVal * rv(scaleVal)/mass[j];
+          }
+      }
+    } else {
+      // on several threads every particle collects its own pulls (both halves of a pair are computed, one by each particle),
+      // and it gets a generator of its own for the random multipliers, seeded from a number drawn once this frame
+      uint32_t frameSeed = rnd::uniform() * 4294967295.0;
+      parallelFor(partNum, 64, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            rnd::Random<> rng(frameSeed + i);
             auto rv = [&](float scale) -> Vec3f {
             return Vec3f(rng.uniformS(), rng.uniformS(), rng.uniformS()) * scale;
             };
 
-            Vec3f distance(mesh.vertices()[j] - mesh.vertices()[i]); //calculate distances between particles
-            Vec3f gravityVal = gravConst * mass[i] * mass[j] * distance.normalize() / pow(distance.mag(), 2); // F = G * m1 * m2 / r^2
-
-            //using a random multiplier here in order to show a more naturalistic, "swimming" motion of the particles
-            acceleration[i] += gravityVal * rv(scaleVal)/mass[i];
-            acceleration[j] -= gravityVal * rv(scaleVal)/mass[j];
-      }
+            for (int j = 0; j < partNum; j++) {
+                if (j != i) { acceleration[i] += gravity(i, j) * rv(scaleVal)/mass[i]; }
+            }
+        }
+      });
     }
 
     
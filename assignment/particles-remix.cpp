@@ -18,6 +18,8 @@ using namespace al;
 #include <vector>
 using namespace std;
 
+#include "common/parallel.cpp"
+
 string slurp(string fileName); // forward declaration
 
 struct AlloApp : App {
@@ -130,16 +132,34 @@ struct AlloApp : App {
     dt = timeStep;
 
     // Calculate gravitational force
-    for (int i = 0; i < velocity.size(); i++) {
-      for (int j = i + 1; j < velocity.size(); j++) {
-        Vec3f r = mesh.vertices()[j] - mesh.vertices()[i];
-        float distcubed = pow(r.mag(), -2.0);
-        if (distcubed == 0)
-          continue;
-        Vec3f F = GM * mass[j] * mass[i] * r.normalize() / distcubed;
-        acceleration[i] += F * float(asymmetry * 0.1);
-        acceleration[j] -= F * float(asymmetry);
+    auto force = [&](int i, int j) -> Vec3f { // force between i and j, pointing from i to j
+      Vec3f r = mesh.vertices()[j] - mesh.vertices()[i];
+      float distcubed = pow(r.mag(), -2.0);
+      if (distcubed == 0)
+        return Vec3f(0, 0, 0);
+      return GM * mass[j] * mass[i] * r.normalize() / distcubed;
+    };
+    if (parallelThreads() == 1) {
+      for (int i = 0; i < velocity.size(); i++) {
+        for (int j = i + 1; j < velocity.size(); j++) {
+          Vec3f F = force(i, j);
+          acceleration[i] += F * float(asymmetry * 0.1);
+          acceleration[j] -= F * float(asymmetry);
+        }
       }
+    } else {
+      // parallel: the particles are handed out to the threads and each adds up what acts on it alone;
+      // the later particles pull it with asymmetry * 0.1, the earlier ones with the full asymmetry (their push back)
+      parallelFor(velocity.size(), 64, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+          for (int j = 0; j < velocity.size(); j++) {
+            if (j > i)
+              acceleration[i] += force(i, j) * float(asymmetry * 0.1);
+            if (j < i)
+              acceleration[i] += force(i, j) * float(asymmetry);
+          }
+        }
+      });
     }
 
     // Integration